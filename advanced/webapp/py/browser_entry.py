@@ -348,6 +348,14 @@ def run_chunk(instruction_count=10000):
         regformatter = state.machine.make_regformatter_lambda(','.join(state.machine.regs))
 
     try:
+        # Without register logging (written to the terminal below), run the chunk in the machine
+        if regformatter is None:
+            try:
+                state.machine.run(max_instructions=instruction_count)
+            finally:
+                state.instruction_count += state.machine.executed
+            return True
+
         # Execute instructions
         for _ in range(instruction_count):
             # Log registers if enabled (use cyan color for better distinction)
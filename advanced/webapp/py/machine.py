@@ -16,6 +16,8 @@
 #
 
 from elftools.elf.elffile import ELFFile
+from itertools import repeat
+from operator import length_hint
 
 class MachineError(Exception):
     pass
@@ -26,6 +28,9 @@ class InvariantViolationError(MachineError):
 class ExecutionTerminated(MachineError):
     pass
 
+# Steps of the unbounded execution loops (bounded runs iterate over a range instead, see run())
+FOREVER = repeat(None)
+
 class Machine:
     def __init__(self, cpu, ram, timer=False, mmio=False, rvc=False, logger=None, trace=False, regs=None, check_inv=False, start_checks=None):
         self.cpu = cpu
@@ -44,6 +49,7 @@ class Machine:
 
         self.peripheral_list = []
         self.peripheral_runners = []
+        self.executed = 0  # instructions executed by the last bounded run (see run())
 
         if (self.trace or self.regs) and (self.logger is None):
             raise SetupError("Tracing or register logging require a valid logger")
@@ -248,7 +254,7 @@ class Machine:
         return lambda x: ', '.join( f"{name}=0x{getter(x):08X}" for name, getter in getters)  # register formatter
 
     # EXECUTION LOOP: debug version (slow) with optional timer and MMIO
-    def run_with_checks(self):
+    def run_with_checks(self, steps=FOREVER):
         cpu = self.cpu
         ram = self.ram
         timer = self.timer
@@ -259,7 +265,7 @@ class Machine:
         if self.regs:
             regformatter = self.make_regformatter_lambda(self.regs)
 
-        while True:
+        for _ in steps:
             if self.regs:
                 self.logger.debug(f"REGS: " + regformatter(cpu))
             if self.check_inv:
@@ -291,22 +297,22 @@ class Machine:
                     div = 0
 
     # EXECUTION LOOP: minimal version for RV32I only (fastest, no compressed instructions)
-    def run_fast_no_rvc(self):
+    def run_fast_no_rvc(self, steps=FOREVER):
         cpu = self.cpu
         ram = self.ram
 
-        while True:
+        for _ in steps:
             inst = ram.load_word(cpu.pc)
 
             cpu.execute_32(inst)
             cpu.pc = cpu.next_pc
 
     # EXECUTION LOOP: minimal version with RVC support (fast)
-    def run_fast(self):
+    def run_fast(self, steps=FOREVER):
         cpu = self.cpu
         ram = self.ram
 
-        while True:
+        for _ in steps:
             inst = ram.load_word(cpu.pc)
 
             if (inst & 0x3) == 0x3:
@@ -317,11 +323,11 @@ class Machine:
             cpu.pc = cpu.next_pc
 
     # EXECUTION LOOP: minimal version + timer (mtime/mtimecmp)
-    def run_timer(self):
+    def run_timer(self, steps=FOREVER):
         cpu = self.cpu
         ram = self.ram
 
-        while True:
+        for _ in steps:
             inst = ram.load_word(cpu.pc)
 
             if (inst & 0x3) == 0x3:
@@ -333,14 +339,14 @@ class Machine:
             cpu.pc = cpu.next_pc
 
     # EXECUTION LOOP: minimal version + MMIO + optional timer
-    def run_mmio(self):
+    def run_mmio(self, steps=FOREVER):
         cpu = self.cpu
         ram = self.ram
         timer = self.timer
         div = 0
         DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
 
-        while True:
+        for _ in steps:
             inst = ram.load_word(cpu.pc)
 
             if (inst & 0x3) == 0x3:
@@ -362,24 +368,41 @@ class Machine:
     # For performance reasons, we use different implementations of the emulator loop,
     # selected according to the requested features, rather than having a single implementation
     # with several conditions along the hot execution path.
-    def run(self):
+    # Bounded runs return after max_instructions instructions, running the same loop over a range
+    # of steps, and return the number of executed instructions, also saved in self.executed
+    # (when execution stops by raising, too).
+    def run(self, max_instructions=None):
         # Verify initial PC alignment based on RVC support
         alignment_mask = 0x1 if self.rvc else 0x3
         if self.cpu.pc & alignment_mask:
             raise MachineError(f"Initial PC=0x{self.cpu.pc:08X} violates {2 if self.rvc else 4}-byte alignment requirement")
 
+        if max_instructions is None:
+            self.run_loop(FOREVER)
+            return
+
+        steps = iter(range(max_instructions))
+        try:
+            self.run_loop(steps)
+        except BaseException:
+            self.executed = max(max_instructions - length_hint(steps) - 1, 0)  # (the instruction that raised is not counted)
+            raise
+        self.executed = max_instructions
+        return max_instructions
+
+    def run_loop(self, steps):
         if self.regs or self.check_inv or self.trace:
-            self.run_with_checks()  # checks everything at every cycle, up to 3x slower (always with RVC support)
+            self.run_with_checks(steps)  # checks everything at every cycle, up to 3x slower (always with RVC support)
         else:
             if self.mmio:
-                self.run_mmio()  # MMIO support, optional timer (always with RVC support)
+                self.run_mmio(steps)  # MMIO support, optional timer (always with RVC support)
             else:
                 if self.timer:
-                    self.run_timer()  # timer support, no checks, no MMIO (always with RVC support)
+                    self.run_timer(steps)  # timer support, no checks, no MMIO (always with RVC support)
                 else:
                     # Fastest option, no timer, no checks, no MMIO
                     # RVC support is optional for maximum performance on pure RV32I code
                     if self.rvc:
-                        self.run_fast()  # Fast with RVC support (half-word fetches)
+                        self.run_fast(steps)  # Fast with RVC support (half-word fetches)
                     else:
-                        self.run_fast_no_rvc()  # Fastest: pure RV32I (32-bit word fetches)
+                        self.run_fast_no_rvc(steps)  # Fastest: pure RV32I (32-bit word fetches)
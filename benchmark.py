@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+#
+# Compares the CPU time of the pure-Python and Cython-compiled (make compiled) emulator
+# on a few of the prebuilt example programs
+#
+
+import sys, os, argparse, subprocess, resource
+
+from compiled import COMPILED_MODULES, is_up_to_date
+
+DEFAULT_PROGRAMS = ['test_newlib_primes.elf', 'test_newlib_mandelbrot.elf', 'test_newlib_softfloat.elf']
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Benchmark the pure-Python vs. compiled emulator")
+    parser.add_argument("programs", nargs="*", default=DEFAULT_PROGRAMS, help="programs to run (default: a few prebuilt examples)")
+    parser.add_argument("--emu-args", default="--engine=interp", help="extra emulator arguments (default: %(default)s)")
+    parser.add_argument("--runs", type=int, default=3, help="runs per configuration, the fastest one is reported (default: %(default)s)")
+    return parser.parse_args(sys.argv[1:])
+
+# Runs a program and returns the best CPU time (user + system) out of 'runs' runs
+def time_program(program, emu_args, runs, pure):
+    env = dict(os.environ)
+    if pure:
+        env['RISCV_EMU_PURE_PYTHON'] = '1'
+    else:
+        env.pop('RISCV_EMU_PURE_PYTHON', None)
+
+    cmd = [sys.executable, 'riscv-emu.py'] + emu_args + [program]
+    best = None
+    for _ in range(runs):
+        start = resource.getrusage(resource.RUSAGE_CHILDREN)
+        result = subprocess.run(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, env=env)
+        end = resource.getrusage(resource.RUSAGE_CHILDREN)
+        elapsed = (end.ru_utime - start.ru_utime) + (end.ru_stime - start.ru_stime)
+        if result.returncode != 0:
+            raise RuntimeError(f"{' '.join(cmd)} exited with status {result.returncode}")
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+# MAIN
+if __name__ == '__main__':
+    args = parse_args()
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+    if not all(is_up_to_date(name) for name in COMPILED_MODULES):
+        print("Compiled modules missing or out of date, run 'make compiled' first", file=sys.stderr)
+        sys.exit(1)
+
+    emu_args = args.emu_args.split()
+    print(f"{'program':<32} {'pure (s)':>10} {'compiled (s)':>13} {'speedup':>8}")
+    for program in args.programs:
+        path = program if os.path.exists(program) else os.path.join('prebuilt', program)
+        t_pure = time_program(path, emu_args, args.runs, pure=True)
+        t_compiled = time_program(path, emu_args, args.runs, pure=False)
+        print(f"{os.path.basename(program):<32} {t_pure:>10.2f} {t_compiled:>13.2f} {t_pure / t_compiled:>7.2f}x")
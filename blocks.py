@@ -0,0 +1,586 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+import operator
+from functools import partial
+from machine import MachineError, CodeModified
+from cpu import decode_leaf
+from rvc import expansion_table
+
+# Basic-block translation cache.
+#
+# A block is the straight-line run of instructions starting at a given PC, up to and including
+# the first instruction that may alter control flow (branches, jumps, SYSTEM, MISC-MEM, AMO,
+# or any encoding that would trap as illegal). Blocks are decoded once and cached by PC as
+# (body, term_pc, term) tuples:
+#
+# - body:     tuple of (pc, op) pairs, where op is a handler call with all operands pre-bound
+# - term_pc:  PC of the terminating instruction
+# - term:     pre-bound call to CPU.execute_32/execute_16 for the terminating instruction,
+#             which takes care of next_pc, traps and x0 exactly like the interpreter
+#
+# Body instructions never trap and never write x0, so the run loop only needs to keep cpu.pc
+# up to date (for AUIPC and for error reporting) and can skip next_pc entirely.
+#
+# When a hot-block compiler is attached (see jit.py), blocks executed more than HOT_THRESHOLD
+# times are replaced by generated Python functions, cached as ((), start_pc, function) so that
+# the run loop does not need to tell them apart. The run loop also reports back-edges (control
+# transfers to a lower or equal PC) to back_edge(): once a loop head has been reached that way
+# TRACE_THRESHOLD times, the compiler records the path taken from there and turns it into a
+# trace (superblock) spanning several blocks, cached at the loop head in the same way.
+#
+# While translating, pairs of adjacent instructions forming common idioms are fused into a single
+# op (see fuse_pair and fuse_terminator), saving a trip through the run loop, and conditional
+# branches with constant targets are executed directly instead of through CPU.execute_*.
+# Blocks forming a whole memset-style (store) or memcpy-style (load + store) counted loop get an
+# extra first op that runs all iterations but the last at once, as a bytearray slice operation on
+# guest memory (see loop_idiom); such blocks are neither compiled nor traced.
+#
+# The entry points of intercepted guest routines (see intercept.py) get blocks of their own, made
+# of a single terminator calling the host-native implementation (or executing the instruction at
+# the entry point, if the routine falls back to emulation); such blocks are neither compiled nor traced.
+#
+# Blocks are keyed by PC, so they must be discarded when code is modified. Their code is marked in
+# the RAM page bitmap (see ram.py): any store into it, from translated code or not (including DMA),
+# invalidates the blocks and traces it overlaps through Machine.invalidate_code, and FENCE.I flushes
+# the whole cache (as required by the RISC-V spec for self-modifying code). A store may also modify
+# a later instruction of the block being executed: stores in block bodies (and in compiled code)
+# compare the cache epoch before and after the store, and leave the block if the store discarded
+# blocks, so that execution resumes at the next instruction from freshly translated code. (Loop idiom ops
+# give up on loops that would write over their own block.)
+
+MAX_BLOCK_LEN = 64  # maximum number of instructions per block
+HOT_THRESHOLD = 32  # executions before a block is handed to the compiler
+TRACE_THRESHOLD = 64  # back-edges to a loop head before a trace is recorded
+PAGE_SHIFT = 8      # granularity of the code page index (256 bytes)
+
+def exec_load_const(cpu, rd, value):  # AUIPC, with the PC folded in at translation time
+    cpu.registers[rd] = value
+
+def exec_store(cache, store, cpu, rs1, rs2, imm, next_pc):  # store in a block body (see BlockCache.invalidate)
+    epoch = cache.epoch
+    store(cpu, 0, rs1, rs2, imm)
+    if cache.epoch != epoch:
+        cpu.next_pc = next_pc
+        raise CodeModified(f"Translated code modified at PC=0x{cpu.pc:08X}")
+
+def exec_fall_through(cpu, next_pc):  # ends a block whose next instruction cannot be fetched yet (or is intercepted)
+    cpu.next_pc = next_pc
+
+def exec_intercept(call, execute):  # entry point of an intercepted routine: host-native call, or the instruction itself
+    if not call():
+        execute()
+
+# Fused instruction pairs
+
+def exec_const_load(cpu, rd, value, load_pc, load_rd, load, addr):  # LUI/AUIPC + load from a constant address
+    cpu.registers[rd] = value
+    cpu.pc = load_pc  # if the load faults, report its own PC (the LUI/AUIPC has completed)
+    cpu.registers[load_rd] = load(addr) & 0xFFFFFFFF
+
+def exec_zero_extend(cpu, rd, rs1, mask):  # SLLI + SRLI by the same amount
+    cpu.registers[rd] = cpu.registers[rs1] & mask
+
+def exec_sign_extend(cpu, rd, rs1, sign_bit):  # SLLI + SRAI by the same amount
+    cpu.registers[rd] = (((cpu.registers[rs1] & ((sign_bit << 1) - 1)) ^ sign_bit) - sign_bit) & 0xFFFFFFFF
+
+def exec_branch(cpu, test, rs1, rs2, target, fall_through):  # conditional branch with a valid constant target
+    cpu.next_pc = target if test(cpu.registers[rs1], cpu.registers[rs2]) else fall_through
+
+def exec_op_branch(cpu, op, test, rs1, rs2, target, fall_through):  # ALU operation + conditional branch
+    op()
+    cpu.next_pc = target if test(cpu.registers[rs1], cpu.registers[rs2]) else fall_through
+
+def exec_far_jump(cpu, rd, value, link_rd, link, target):  # AUIPC + JALR to a constant target
+    cpu.registers[rd] = value
+    if link_rd:
+        cpu.registers[link_rd] = link
+    cpu.next_pc = target
+
+# Branch conditions on (unsigned 32-bit) register values, by funct3
+BRANCH_TESTS = {
+    0x0: operator.eq,
+    0x1: operator.ne,
+    0x4: lambda a, b: (a ^ 0x80000000) < (b ^ 0x80000000),   # BLT
+    0x5: lambda a, b: (a ^ 0x80000000) >= (b ^ 0x80000000),  # BGE
+    0x6: operator.lt,
+    0x7: operator.ge,
+}
+
+def imm_i(inst):
+    imm = inst >> 20
+    return imm - 0x1000 if imm >= 0x800 else imm
+
+def imm_s(inst):
+    imm = ((inst >> 7) & 0x1F) | ((inst >> 25) << 5)
+    return imm - 0x1000 if imm >= 0x800 else imm
+
+def imm_b(inst):
+    imm = (((inst >> 7) & 0x1) << 11) | (((inst >> 8) & 0xF) << 1) | (((inst >> 25) & 0x3F) << 5) | ((inst >> 31) << 12)
+    return imm - 0x2000 if imm >= 0x1000 else imm
+
+# Returns the value written by LUI/AUIPC, or None for other instructions
+def const_value(decoded):
+    (pc, inst, inst_size, expanded_inst, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+    if opcode == 0x37:
+        return expanded_inst & 0xFFFFF000
+    elif opcode == 0x17:
+        return (pc + (expanded_inst & 0xFFFFF000)) & 0xFFFFFFFF
+    return None
+
+# Returns True if the decoded instruction can be part of a block body,
+# i.e., it never traps, never writes x0 and falls through to the next instruction.
+def is_straight_line(opcode, rd, funct3, funct7):
+    if opcode == 0x33:  # R-type
+        return funct7 == 0x00 or funct7 == 0x01 or (funct7 == 0x20 and funct3 in (0x0, 0x5))
+    elif opcode == 0x13:  # I-type
+        if funct3 == 0x1:
+            return funct7 == 0x00
+        elif funct3 == 0x5:
+            return funct7 in (0x00, 0x20)
+        return True
+    elif opcode == 0x03:  # Loads (loads into x0 still need to zero it)
+        return rd != 0 and funct3 in (0x0, 0x1, 0x2, 0x4, 0x5)
+    elif opcode == 0x23:  # Stores
+        return funct3 in (0x0, 0x1, 0x2)
+    elif opcode in (0x37, 0x17):  # LUI, AUIPC
+        return True
+    return False
+
+class BlockCache:
+    def __init__(self, cpu, ram, jit=False, intercepts=None):
+        self.cpu = cpu
+        self.ram = ram
+        self.intercepts = intercepts if intercepts is not None else {}  # entry PC -> host-native routine (see intercept.py)
+        self.ram_base = getattr(ram, 'base_addr', 0)  # guest address of ram.memory[0]
+        self.blocks = {}      # start PC -> (body, term_pc, term)
+        self.extents = {}     # start PC -> tuple of (start, end) guest address ranges covered by the block
+        self.code_pages = {}  # code page -> set of start PCs of the blocks overlapping it
+        self.epoch = 0        # incremented whenever blocks are discarded
+
+        # hot-block compiler (optional)
+        self.compiler = None
+        self.counts = {}      # start PC -> execution count (cold blocks only)
+        self.edge_counts = {} # loop head PC -> number of back-edges reaching it
+        self.traces = set()   # start PCs of the cached traces
+        self.idiom_loops = set()  # start PCs of the blocks with a loop idiom op (never compiled)
+        if jit:
+            from jit import BlockCompiler
+            self.compiler = BlockCompiler(self)
+
+    # Discard all translated blocks (e.g., on FENCE.I)
+    def flush(self):
+        self.blocks.clear()
+        self.extents.clear()
+        self.code_pages.clear()
+        self.counts.clear()
+        self.edge_counts.clear()
+        self.traces.clear()
+        self.idiom_loops.clear()
+        self.epoch += 1
+
+    # Discard the translated blocks overlapping guest memory range [addr, addr+size)
+    def invalidate(self, addr, size):
+        end = addr + size
+        for page in range(addr >> PAGE_SHIFT, ((end - 1) >> PAGE_SHIFT) + 1):
+            starts = self.code_pages.get(page)
+            if starts is None:
+                continue
+            for start_pc in list(starts):
+                if any(lo < end and hi > addr for (lo, hi) in self.extents[start_pc]):
+                    self.discard(start_pc)
+
+    def discard(self, start_pc):
+        self.unindex(start_pc)
+        del self.blocks[start_pc]
+        self.counts.pop(start_pc, None)
+        self.edge_counts.pop(start_pc, None)
+        self.traces.discard(start_pc)
+        self.idiom_loops.discard(start_pc)
+        self.epoch += 1
+
+    # Remove a block from the code page index
+    def unindex(self, start_pc):
+        for (lo, hi) in self.extents.pop(start_pc):
+            for page in range(lo >> PAGE_SHIFT, ((hi - 1) >> PAGE_SHIFT) + 1):
+                starts = self.code_pages.get(page)
+                if starts is not None:
+                    starts.discard(start_pc)
+                    if not starts:
+                        del self.code_pages[page]
+
+    # Decode the instructions of the block starting at pc.
+    # Returns a list of (pc, inst, inst_size, expanded_inst, success, opcode, rd, funct3, rs1, rs2, funct7)
+    # tuples, the last one being the block terminator. A terminator with inst=None marks a block
+    # that falls through to an instruction that cannot be fetched (yet), or to the entry point of
+    # an intercepted routine.
+    def decode_block(self, pc):
+        ram = self.ram
+        rvc = self.cpu.rvc_enabled
+        rvc_table = expansion_table() if rvc else None
+        intercepts = self.intercepts
+        insts = []
+
+        while True:
+            if insts and pc in intercepts:
+                insts.append((pc, None, 0, None, False, None, 0, 0, 0, 0, 0))
+                return insts
+
+            try:
+                inst = ram.load_word(pc)
+            except MachineError:
+                if not insts:
+                    raise  # fetch fault on the first instruction: report it right away
+                # otherwise, end the block here and let the fault happen when pc is reached
+                insts.append((pc, None, 0, None, False, None, 0, 0, 0, 0, 0))
+                return insts
+
+            if rvc and (inst & 0x3) != 0x3:
+                inst &= 0xFFFF
+                expanded_inst = rvc_table[inst]
+                success = expanded_inst != 0
+                inst_size = 2
+            else:
+                expanded_inst, success = inst, True
+                inst_size = 4
+
+            opcode = expanded_inst & 0x7F
+            rd = (expanded_inst >> 7) & 0x1F
+            funct3 = (expanded_inst >> 12) & 0x7
+            rs1 = (expanded_inst >> 15) & 0x1F
+            rs2 = (expanded_inst >> 20) & 0x1F
+            funct7 = (expanded_inst >> 25) & 0x7F
+
+            insts.append((pc, inst, inst_size, expanded_inst, success, opcode, rd, funct3, rs1, rs2, funct7))
+
+            if not success or not is_straight_line(opcode, rd, funct3, funct7) or len(insts) == MAX_BLOCK_LEN:
+                return insts
+
+            pc = (pc + inst_size) & 0xFFFFFFFF
+
+    # Decode the block starting at pc, cache it and return it
+    def translate(self, pc):
+        cpu = self.cpu
+        ram = self.ram
+        start_pc = pc
+        if pc in self.intercepts:
+            return self.translate_intercept(pc)
+        insts = self.decode_block(start_pc)
+
+        body = []
+        idiom = self.loop_idiom(insts)
+        if idiom is not None:
+            body.append((start_pc, idiom))
+            self.idiom_loops.add(start_pc)
+        elif self.compiler is not None:
+            body.append((start_pc, partial(self.profile, start_pc)))
+
+        # fuse the last body instruction with the terminator, if possible
+        term = None
+        if len(insts) >= 2:
+            term = self.fuse_terminator(insts[-2], insts[-1])
+            if term is not None:
+                del insts[-2]
+        if term is None:
+            term = self.direct_terminator(insts[-1])
+
+        i = 0
+        while i < len(insts) - 1:
+            decoded = insts[i]
+            i += 1
+            (pc, inst, inst_size, expanded_inst, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+            if i < len(insts) - 1:
+                op = self.fuse_pair(decoded, insts[i])
+                if op is not None:
+                    body.append((pc, op))
+                    i += 1
+                    continue
+
+            if rd == 0 and opcode != 0x23:
+                pass  # ALU operations, LUI and AUIPC with rd=x0 are HINTs: no side effects
+            elif opcode == 0x17:  # AUIPC
+                value = (pc + (expanded_inst & 0xFFFFF000)) & 0xFFFFFFFF
+                body.append((pc, partial(exec_load_const, cpu, rd, value)))
+            elif opcode == 0x23:  # Stores: leave the block if they modify translated code
+                handler, a, b, c, d = decode_leaf(expanded_inst, inst_size, cpu.isa)
+                body.append((pc, partial(exec_store, self, handler, cpu, b, c, d, (pc + inst_size) & 0xFFFFFFFF)))
+            else:
+                handler, a, b, c, d = decode_leaf(expanded_inst, inst_size, cpu.isa)
+                body.append((pc, partial(handler, cpu, a, b, c, d)))
+
+        term_pc, inst, inst_size = insts[-1][:3]
+        if term is not None:
+            pass
+        elif inst is None:
+            term = partial(exec_fall_through, cpu, term_pc)
+        else:
+            term = partial(cpu.execute_16 if inst_size == 2 else cpu.execute_32, inst)
+
+        block = (tuple(body), term_pc, term)
+        self.install(start_pc, ((start_pc, term_pc + inst_size),), block)
+        return block
+
+    # Cache and return the block of the entry point of an intercepted routine
+    def translate_intercept(self, pc):
+        cpu = self.cpu
+        inst = self.ram.load_word(pc)
+        if cpu.rvc_enabled and (inst & 0x3) != 0x3:
+            inst_size, execute = 2, partial(cpu.execute_16, inst & 0xFFFF)
+        else:
+            inst_size, execute = 4, partial(cpu.execute_32, inst)
+        block = ((), pc, partial(exec_intercept, self.intercepts[pc], execute))
+        self.install(pc, ((pc, pc + inst_size),), block)
+        return block
+
+    # Fuse two adjacent body instructions into a single op, returns None if they do not form a known idiom
+    def fuse_pair(self, first, second):
+        cpu = self.cpu
+        (pc, inst, inst_size, e1, success, opcode1, rd1, funct3_1, rs1_1, rs2_1, funct7_1) = first
+        (pc2, inst, inst_size, e2, success, opcode2, rd2, funct3_2, rs1_2, rs2_2, funct7_2) = second
+        if rd1 == 0 or rs1_2 != rd1:
+            return None
+
+        value = const_value(first)
+        if value is not None:
+            if opcode2 == 0x13 and funct3_2 == 0x0 and rd2 == rd1:  # LUI/AUIPC + ADDI: 32-bit constant
+                return partial(exec_load_const, cpu, rd1, (value + imm_i(e2)) & 0xFFFFFFFF)
+            elif opcode2 == 0x03:  # LUI/AUIPC + load
+                ram = self.ram
+                load = {0x0: ram.load_byte, 0x1: ram.load_half, 0x2: ram.load_word,
+                        0x4: partial(ram.load_byte, signed=False), 0x5: partial(ram.load_half, signed=False)}[funct3_2]
+                return partial(exec_const_load, cpu, rd1, value, pc2, rd2, load, (value + imm_i(e2)) & 0xFFFFFFFF)
+
+        elif opcode1 == 0x13 and funct3_1 == 0x1 and opcode2 == 0x13 and funct3_2 == 0x5 and rd2 == rd1:
+            shamt = imm_i(e1) & 0x1F
+            if shamt == 0 or (imm_i(e2) & 0x1F) != shamt:
+                return None
+            if funct7_2 == 0x00:  # SLLI + SRLI: zero extension
+                return partial(exec_zero_extend, cpu, rd1, rs1_1, (1 << (32 - shamt)) - 1)
+            elif funct7_2 == 0x20:  # SLLI + SRAI: sign extension
+                return partial(exec_sign_extend, cpu, rd1, rs1_1, 1 << (31 - shamt))
+
+        return None
+
+    # Fuse the last body instruction with the block terminator, returns None if not possible
+    def fuse_terminator(self, first, term):
+        cpu = self.cpu
+        (pc, inst, inst_size, e1, success, opcode1, rd1, funct3_1, rs1_1, rs2_1, funct7_1) = first
+        (pc2, inst, inst_size, e2, success, opcode2, rd2, funct3_2, rs1_2, rs2_2, funct7_2) = term
+        if inst is None or not success or rd1 == 0:
+            return None
+        fall_through = (pc2 + inst_size) & 0xFFFFFFFF
+
+        branch = self.direct_terminator(term)
+        if branch is not None and opcode1 in (0x13, 0x33, 0x37, 0x17):  # ALU operation + branch (e.g., C.ADDI + C.BNEZ)
+            if opcode1 == 0x17:
+                op = partial(exec_load_const, cpu, rd1, const_value(first))
+            else:
+                handler, a, b, c, d = decode_leaf(e1, 4, cpu.isa)
+                op = partial(handler, cpu, a, b, c, d)
+            return partial(exec_op_branch, cpu, op, *branch.args[1:])
+
+        if opcode1 == 0x17 and opcode2 == 0x67 and funct3_2 == 0x0 and rs1_2 == rd1:  # AUIPC + JALR: far call/jump
+            value = const_value(first)
+            target = (value + imm_i(e2)) & 0xFFFFFFFE
+            if not (target & cpu.alignment_mask):
+                return partial(exec_far_jump, cpu, rd1, value, rd2, fall_through, target)
+
+        return None
+
+    # Conditional branch to a valid constant target, executed without going through CPU.execute_*
+    def direct_terminator(self, term):
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = term
+        if inst is None or not success or opcode != 0x63 or funct3 not in BRANCH_TESTS:
+            return None
+        target = (pc + imm_b(e)) & 0xFFFFFFFF
+        if target & self.cpu.alignment_mask:
+            return None  # misaligned target: let the interpreter raise the trap
+        return partial(exec_branch, self.cpu, BRANCH_TESTS[funct3], rs1, rs2, target, (pc + inst_size) & 0xFFFFFFFF)
+
+    # Recognize blocks forming a whole counted store loop (memset-style) or load/store loop
+    # (memcpy-style): a conditional branch (BLT, BLTU, BNE) back to the start of the block, stores,
+    # the loads feeding them, and ADDI steps of induction registers, in any order, e.g.:
+    #     loop: sw   zero, 0(t0)                 loop: lbu  a5, 0(a1)
+    #           addi t0, t0, 4                         sb   a5, 0(a0)
+    #           blt  t0, t1, loop                      addi a1, a1, 1
+    #                                                  addi a0, a0, 1
+    #                                                  bne  a0, a2, loop
+    # Each iteration must store a contiguous chunk of memory right after the one stored by the
+    # previous iteration (the stores share a base register stepping by the chunk size, as in unrolled
+    # memset loops), and copies must load it from a chunk laid out the same way. Stored values (other
+    # than loaded ones) and the loop bound must be loop-invariant.
+    # Returns a body op (see exec_loop_idiom) or None.
+    def loop_idiom(self, insts):
+        start_pc = insts[0][0]
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = insts[-1]
+        if inst is None or not success or opcode != 0x63 or funct3 not in (0x1, 0x4, 0x6):
+            return None  # BNE, BLT, BLTU
+        if (pc + imm_b(e)) & 0xFFFFFFFF != start_pc:
+            return None
+        test, cond_rs1, cond_rs2 = funct3, rs1, rs2
+
+        steps = {}   # induction register -> (step, body index of its ADDI)
+        stores = []  # (body index, base, value register, offset, size)
+        loads = {}   # destination register -> (body index, base, offset, size)
+        for index, (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) in enumerate(insts[:-1]):
+            if opcode == 0x13 and funct3 == 0x0 and rd == rs1 and rd != 0 and rd not in steps:
+                steps[rd] = (imm_i(e), index)
+            elif opcode == 0x23:
+                stores.append((index, rs1, rs2, imm_s(e), 1 << funct3))
+            elif opcode == 0x03 and rd != 0 and rd not in loads and funct3 in (0x0, 0x1, 0x2, 0x4, 0x5):
+                loads[rd] = (index, rs1, imm_i(e), 1 << (funct3 & 0x3))
+            else:
+                return None
+        if not stores or len({base for (_, base, _, _, _) in stores} | {base for (_, base, _, _) in loads.values()}) > 2:
+            return None
+
+        # offsets of the accesses from the values of their base register at the start of the iteration
+        def offset(index, base, imm):
+            step, step_index = steps[base]
+            return imm + step if step_index < index else imm
+
+        dst_base = stores[0][1]
+        chunk = steps.get(dst_base, (0,))[0]
+        if chunk <= 0 or any(base != dst_base for (_, base, _, _, _) in stores):
+            return None
+        layout = sorted((offset(index, base, imm), size, value, index) for (index, base, value, imm, size) in stores)
+        if any(layout[i][0] + layout[i][1] != layout[i + 1][0] for i in range(len(layout) - 1)):
+            return None
+        dst_offset = layout[0][0]
+        if layout[-1][0] + layout[-1][1] - dst_offset != chunk:
+            return None  # chunks must be adjacent
+
+        if loads:
+            # copy: each store writes a value loaded earlier in the iteration, from the same relative position
+            src_base = next(iter(loads.values()))[1]
+            if steps.get(src_base, (0,))[0] != chunk or len(loads) != len(stores) or src_base in loads or dst_base in loads:
+                return None
+            deltas = set()  # (source offset - destination offset of each load/store pair)
+            for (dst_off, size, value, index) in layout:
+                load = loads.get(value)
+                if load is None or load[1] != src_base or load[3] != size or load[0] > index:
+                    return None
+                deltas.add(offset(load[0], src_base, load[2]) - dst_off)
+            if len(deltas) != 1:
+                return None
+            src_offset = dst_offset + deltas.pop()
+            fill = None
+            copy = (src_base, src_offset, len(stores) == 1)
+        else:
+            if any(value in steps for (_, _, value, _) in layout):
+                return None
+            fill = tuple((value, size) for (_, size, value, _) in layout)
+            copy = None
+
+        # loop condition: induction register against a loop-invariant bound
+        variant = set(steps) | set(loads)
+        if test == 0x1 and cond_rs2 in steps and cond_rs1 not in variant:
+            cond_rs1, cond_rs2 = cond_rs2, cond_rs1  # (BNE is symmetric)
+        if cond_rs1 not in steps or cond_rs2 in variant or (test != 0x1 and steps[cond_rs1][0] <= 0):
+            return None
+
+        steps_list = tuple((reg, step) for reg, (step, index) in steps.items())
+        return partial(self.exec_loop_idiom, self.cpu, steps_list, test, cond_rs1, steps[cond_rs1][0], cond_rs2,
+                       dst_base, dst_offset, chunk, fill, copy, (start_pc, insts[-1][0] + insts[-1][2]))
+
+    # Loop idiom op, executed at the start of each iteration: if the loop runs for N more iterations
+    # and all their accesses are plain RAM accesses, performs the first N-1 of them at once, otherwise
+    # does nothing. The last iteration is then executed by the block itself, so loaded registers get
+    # their final values from the actual loads.
+    def exec_loop_idiom(self, cpu, steps, test, ind, step, bound, dst_base, dst_offset, chunk, fill, copy, code):
+        regs = cpu.registers
+        start, end = regs[ind], regs[bound]
+
+        # number of iterations left (giving up on loops that would wrap around)
+        if test == 0x1:  # BNE
+            dist = (end - start) & 0xFFFFFFFF if step > 0 else (start - end) & 0xFFFFFFFF
+            if dist == 0 or dist % abs(step):
+                return
+            n = dist // abs(step)
+        else:  # BLT, BLTU (positive step)
+            if test == 0x4:  # signed compare
+                start ^= 0x80000000
+                end ^= 0x80000000
+            n = max((end - start + step - 1) // step, 1)
+            if start + n * step > 0xFFFFFFFF:
+                return
+        count = n - 1
+        if count <= 0:
+            return
+
+        # accessed guest memory ranges
+        nbytes = count * chunk
+        ram = self.ram
+        dst = (regs[dst_base] + dst_offset) & 0xFFFFFFFF
+        dst_index = dst - self.ram_base
+        if dst_index < 0 or dst_index + nbytes > ram.size or self.is_mmio(dst, nbytes):
+            return
+        if dst < code[1] and code[0] < dst + nbytes:
+            return  # the loop writes over its own code: leave it to the stores (see exec_store)
+        if copy is not None:
+            src_base, src_offset, single = copy
+            src = (regs[src_base] + src_offset) & 0xFFFFFFFF
+            src_index = src - self.ram_base
+            if src_index < 0 or src_index + nbytes > ram.size or self.is_mmio(src, nbytes):
+                return
+            if src < dst + nbytes and dst < src + nbytes and not (single and (dst <= src or (dst - src) % chunk == 0)):
+                return  # overlapping copy that cannot be done as a slice operation
+
+        memory = ram.memory
+        if fill is not None:
+            pattern = b''.join((regs[value] & ((1 << (8 * size)) - 1)).to_bytes(size, 'little') for (value, size) in fill)
+            memory[dst_index:dst_index + nbytes] = pattern * count
+        elif src < dst < src + nbytes:  # overlapping copy to higher addresses: repeats the first dst-src bytes
+            memory[dst_index:dst_index + nbytes] = (memory[src_index:dst_index] * (nbytes // (dst - src) + 1))[:nbytes]
+        else:
+            memory[dst_index:dst_index + nbytes] = memory[src_index:src_index + nbytes]
+
+        for reg, reg_step in steps:
+            regs[reg] = (regs[reg] + count * reg_step) & 0xFFFFFFFF
+        cpu.reservation_valid = False  # Clear any LR/SC reservation
+        ram.check_code(dst, nbytes)  # (written directly into memory)
+
+    # Returns True if guest memory range [addr, addr+size) overlaps an MMIO range
+    def is_mmio(self, addr, size):
+        return any(lo < addr + size and hi > addr for (lo, hi, *_) in getattr(self.ram, 'mmio_ranges', ()))
+
+    # Add a block to the cache and to the code page index (replacing any block with the same start PC)
+    def install(self, start_pc, ranges, block):
+        if start_pc in self.extents:
+            self.unindex(start_pc)
+        self.blocks[start_pc] = block
+        self.extents[start_pc] = ranges
+        for (lo, hi) in ranges:
+            for page in range(lo >> PAGE_SHIFT, ((hi - 1) >> PAGE_SHIFT) + 1):
+                self.code_pages.setdefault(page, set()).add(start_pc)
+            self.ram.mark_code(lo, hi - lo)
+
+    # Execution counter of cold blocks: once a block gets hot, replace it with compiled code
+    def profile(self, start_pc):
+        count = self.counts.get(start_pc, 0) + 1
+        if count < HOT_THRESHOLD:
+            self.counts[start_pc] = count
+            return
+        self.counts.pop(start_pc, None)
+        self.blocks[start_pc] = ((), start_pc, self.compiler.compile(start_pc))
+
+    # Called by the run loop on control transfers to pc from a higher or equal PC
+    def back_edge(self, pc):
+        count = self.edge_counts.get(pc, 0) + 1
+        self.edge_counts[pc] = count
+        if count == TRACE_THRESHOLD and pc not in self.idiom_loops and pc not in self.intercepts:
+            self.compiler.record_trace(pc)
@@ -0,0 +1,61 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+# Loader for the optional Cython-compiled build of the emulator core modules ('make compiled').
+#
+# The build copies the pure-Python sources to build/compiled/ and compiles them there, so the
+# pure-Python modules remain the single source of truth: the compiled modules are only used if
+# every one of them was built from the current version of its source file.
+# Set RISCV_EMU_PURE_PYTHON=1 in the environment to always use the pure-Python modules.
+
+import os, sys
+from importlib.machinery import EXTENSION_SUFFIXES
+
+SOURCE_DIR = os.path.dirname(os.path.abspath(__file__))
+COMPILED_DIR = os.path.join(SOURCE_DIR, 'build', 'compiled')
+COMPILED_MODULES = ('cpu', 'rvc', 'ram', 'machine')
+
+# Returns True if the two files have the same contents (or are both missing)
+def same_contents(fname1, fname2):
+    try:
+        with open(fname1, 'rb') as f1, open(fname2, 'rb') as f2:
+            return f1.read() == f2.read()
+    except OSError:
+        return not os.path.exists(fname1) and not os.path.exists(fname2)
+
+# Returns True if the compiled module is present and was built from the current source (and Cython declarations)
+def is_up_to_date(name):
+    for ext in ('.py', '.pxd'):
+        if not same_contents(os.path.join(SOURCE_DIR, name + ext), os.path.join(COMPILED_DIR, name + ext)):
+            return False
+    return any(os.path.exists(os.path.join(COMPILED_DIR, name + suffix)) for suffix in EXTENSION_SUFFIXES)
+
+# Make the compiled modules take precedence over the pure-Python ones, if they are usable.
+# Must be called before any of the emulator modules is imported. Returns True if compiled modules are used.
+def use_compiled_modules():
+    if os.environ.get('RISCV_EMU_PURE_PYTHON') or not os.path.isdir(COMPILED_DIR):
+        return False
+    if any(name in sys.modules for name in COMPILED_MODULES):
+        return False  # too late: pure-Python modules already loaded
+
+    if not all(is_up_to_date(name) for name in COMPILED_MODULES):
+        print("Warning: compiled modules in build/compiled/ are out of date, using pure-Python modules "
+              "(run 'make compiled' to rebuild them)", file=sys.stderr)
+        return False
+
+    sys.path.insert(0, COMPILED_DIR)
+    return True
@@ -0,0 +1,108 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+# Cython declarations for the compiled build of cpu.py ('make compiled', see compiled.py).
+# CPU becomes an extension type whose hot state lives in typed slots (registers stays a plain
+# list, as it is shared with the syscall handler, the GDB stub and the block cache), and the leaf
+# handlers become cpdef functions with C-typed register indices. Attributes that are not declared
+# here live in the instance __dict__, just like in the pure-Python module.
+
+from ram cimport RAM
+
+cdef class CPU:
+    cdef dict __dict__
+    cdef public list registers
+    cdef public list csrs
+    cdef public object pc, next_pc
+    cdef public RAM ram
+    cdef public object handle_ecall
+    cdef public object logger
+    cdef public object trace_traps
+    cdef public object rvc_enabled
+    cdef public object alignment_mask
+    cdef public object mtime, mtimecmp, mtip, wfi_fast_forward
+    cdef public object interrupt_check, timer_deadline
+    cdef public object reservation_valid, reservation_addr
+    cdef public object isa
+    cdef public dict decode_cache, decode_cache_compressed
+    cdef public object decoder, decoder_compressed
+    cdef public object block_cache, handle_fence_i
+
+    cpdef execute_32(self, inst)
+    cpdef execute_16(self, inst16)
+    cpdef execute(self, inst)
+    cpdef timer_countdown(self, limit)
+    cpdef timer_update(self)
+
+cpdef long long signed32(long long val)
+cpdef branch_to(CPU cpu, imm)
+cpdef amo_address(CPU cpu, Py_ssize_t rs1)
+cpdef amo_rmw(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, op)
+
+cpdef exec_ADD(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SUB(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLL(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLT(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLTU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_XOR(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SRL(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SRA(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_OR(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_AND(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+
+cpdef exec_MUL(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_MULH(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_MULHSU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_MULHU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_DIV(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_DIVU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_REM(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_REMU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+
+cpdef exec_ADDI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLLI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLTI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SLTIU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_XORI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SRLI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SRAI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_ORI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_ANDI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+
+cpdef exec_LB(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_LH(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_LW(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_LBU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_LHU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SB(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SH(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SW(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+
+cpdef exec_BEQ(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_BNE(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_BLT(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_BGE(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_BLTU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_BGEU(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+
+cpdef exec_LUI(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_AUIPC(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_JAL(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t inst_size, imm)
+cpdef exec_JALR(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t inst_size, imm)
+
+cpdef exec_LR_W(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
+cpdef exec_SC_W(CPU cpu, Py_ssize_t rd, Py_ssize_t rs1, Py_ssize_t rs2, imm)
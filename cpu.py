@@ -16,302 +16,239 @@
 #
 
 from machine import MachineError, ExecutionTerminated, SetupError
-from rvc import expand_compressed
+from rvc import expansion_table
 import random
 
-# Opcode handlers
+# Instruction handlers
+#
+# The decoder (decode_leaf) resolves each instruction to a leaf handler implementing one concrete
+# operation, together with four pre-decoded operands, so that executing a cached instruction
+# involves no field decoding at all. Leaf handlers are called as handler(cpu, rd, rs1, rs2, imm),
+# where imm is the sign-extended immediate (or shift amount) of the instruction. A few handlers
+# use the operand slots differently, as noted below.
 
 def signed32(val):
     return val if val < 0x80000000 else val - 0x100000000
 
-def exec_Rtype(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    if funct3 == 0x0:  # ADD/SUB/MUL
-        if funct7 == 0x00:  # ADD
-            cpu.registers[rd] = (cpu.registers[rs1] + cpu.registers[rs2]) & 0xFFFFFFFF
-        elif funct7 == 0x20:  # SUB
-            cpu.registers[rd] = (cpu.registers[rs1] - cpu.registers[rs2]) & 0xFFFFFFFF
-        elif funct7 == 0x01:  # MUL (M extension)
-            # Multiply: return lower 32 bits of product
-            a = signed32(cpu.registers[rs1])
-            b = signed32(cpu.registers[rs2])
-            result = (a * b) & 0xFFFFFFFF
-            cpu.registers[rd] = result
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for ADD/SUB/MUL at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x1:  # SLL/MULH
-        if funct7 == 0x00:  # SLL
-            cpu.registers[rd] = (cpu.registers[rs1] << (cpu.registers[rs2] & 0x1F)) & 0xFFFFFFFF
-        elif funct7 == 0x01:  # MULH (M extension)
-            # Multiply high: signed × signed, return upper 32 bits
-            a = signed32(cpu.registers[rs1])
-            b = signed32(cpu.registers[rs2])
-            result = (a * b) >> 32
-            cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SLL/MULH at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x2:  # SLT/MULHSU
-        if funct7 == 0x00:  # SLT
-            cpu.registers[rd] = int(signed32(cpu.registers[rs1]) < signed32(cpu.registers[rs2]))
-        elif funct7 == 0x01:  # MULHSU (M extension)
-            # Multiply high: signed × unsigned, return upper 32 bits
-            a = signed32(cpu.registers[rs1])
-            b = cpu.registers[rs2] & 0xFFFFFFFF
-            result = (a * b) >> 32
-            cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SLT/MULHSU at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x3:  # SLTU/MULHU
-        if funct7 == 0x00:  # SLTU
-            cpu.registers[rd] = int((cpu.registers[rs1] & 0xFFFFFFFF) < (cpu.registers[rs2] & 0xFFFFFFFF))
-        elif funct7 == 0x01:  # MULHU (M extension)
-            # Multiply high: unsigned × unsigned, return upper 32 bits
-            a = cpu.registers[rs1] & 0xFFFFFFFF
-            b = cpu.registers[rs2] & 0xFFFFFFFF
-            result = (a * b) >> 32
-            cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SLTU/MULHU at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x4:  # XOR/DIV
-        if funct7 == 0x00:  # XOR
-            cpu.registers[rd] = cpu.registers[rs1] ^ cpu.registers[rs2]
-        elif funct7 == 0x01:  # DIV (M extension)
-            # Signed division (RISC-V uses truncating division, rounding towards zero)
-            dividend = signed32(cpu.registers[rs1])
-            divisor = signed32(cpu.registers[rs2])
-            if divisor == 0:  # Division by zero: quotient = -1
-                cpu.registers[rd] = 0xFFFFFFFF
-            elif dividend == -0x80000000 and divisor == -1:  # Overflow: return MIN_INT
-                cpu.registers[rd] = 0x80000000
-            else:  # Use truncating division (towards zero), not floor division
-                result = int(dividend / divisor)
-                cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for XOR/DIV at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x5:  # SRL/SRA/DIVU
-            shamt = cpu.registers[rs2] & 0x1F
-            if funct7 == 0x00:  # SRL
-                cpu.registers[rd] = (cpu.registers[rs1] & 0xFFFFFFFF) >> shamt
-            elif funct7 == 0x20:  # SRA
-                cpu.registers[rd] = (signed32(cpu.registers[rs1]) >> shamt) & 0xFFFFFFFF
-            elif funct7 == 0x01:  # DIVU (M extension)
-                # Unsigned division
-                dividend = cpu.registers[rs1] & 0xFFFFFFFF
-                divisor = cpu.registers[rs2] & 0xFFFFFFFF
-                if divisor == 0:  # Division by zero: quotient = 2^32 - 1
-                    cpu.registers[rd] = 0xFFFFFFFF
-                else:
-                    result = dividend // divisor
-                    cpu.registers[rd] = result & 0xFFFFFFFF
-            else:
-                if cpu.logger is not None:
-                    cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SRL/SRA/DIVU at PC=0x{cpu.pc:08X}")
-                cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x6:  # OR/REM
-        if funct7 == 0x00:  # OR
-            cpu.registers[rd] = cpu.registers[rs1] | cpu.registers[rs2]
-        elif funct7 == 0x01:  # REM (M extension)
-            # Signed remainder (RISC-V uses truncating division, rounding towards zero)
-            dividend = signed32(cpu.registers[rs1])
-            divisor = signed32(cpu.registers[rs2])
-            if divisor == 0:  # Division by zero: remainder = dividend
-                cpu.registers[rd] = cpu.registers[rs1] & 0xFFFFFFFF
-            elif dividend == -0x80000000 and divisor == -1:  # Overflow: remainder = 0
-                cpu.registers[rd] = 0
-            else:  # Use truncating remainder: dividend - trunc(dividend/divisor) * divisor
-                result = dividend - int(dividend / divisor) * divisor
-                cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for OR/REM at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-
-    elif funct3 == 0x7:  # AND/REMU
-        if funct7 == 0x00:  # AND
-            cpu.registers[rd] = cpu.registers[rs1] & cpu.registers[rs2]
-        elif funct7 == 0x01:  # REMU (M extension)
-            # Unsigned remainder
-            dividend = cpu.registers[rs1] & 0xFFFFFFFF
-            divisor = cpu.registers[rs2] & 0xFFFFFFFF
-            if divisor == 0:
-                # Division by zero: remainder = dividend
-                cpu.registers[rd] = cpu.registers[rs1] & 0xFFFFFFFF
-            else:
-                result = dividend % divisor
-                cpu.registers[rd] = result & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for AND/REMU at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
+# Illegal instructions: (inst, message template, unused, unused), the message is logged with the PC
+def exec_illegal(cpu, inst, message, unused1, unused2):
+    if cpu.logger is not None:
+        cpu.logger.warning(message.format(pc=cpu.pc))
+    cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
 
-def exec_Itype(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_i = inst >> 20
-    if imm_i >= 0x800: imm_i -= 0x1000
+# R-type (RV32I)
 
-    if funct3 == 0x0:  # ADDI
-        cpu.registers[rd] = (cpu.registers[rs1] + imm_i) & 0xFFFFFFFF
-    elif funct3 == 0x1:  # SLLI
-        if funct7 == 0x00:
-            cpu.registers[rd] = (cpu.registers[rs1] << (imm_i & 0x1F)) & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SLLI at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-    elif funct3 == 0x2:  # SLTI
-        cpu.registers[rd] = int(signed32(cpu.registers[rs1]) < signed32(imm_i))
-    elif funct3 == 0x3:  # SLTIU
-        cpu.registers[rd] = int((cpu.registers[rs1] & 0xFFFFFFFF) < (imm_i & 0xFFFFFFFF))
-    elif funct3 == 0x4:  # XORI
-        cpu.registers[rd] = (cpu.registers[rs1] ^ imm_i) & 0xFFFFFFFF
-    elif funct3 == 0x5:  # SRLI/SRAI
-        shamt = imm_i & 0x1F
-        if funct7 == 0x00:  # SRLI
-            cpu.registers[rd] = (cpu.registers[rs1] & 0xFFFFFFFF) >> shamt
-        elif funct7 == 0x20:  # SRAI
-            cpu.registers[rd] = (signed32(cpu.registers[rs1]) >> shamt) & 0xFFFFFFFF
-        else:
-            if cpu.logger is not None:
-                cpu.logger.warning(f"Invalid funct7=0x{funct7:02x} for SRLI/SRAI at PC=0x{cpu.pc:08X}")
-            cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-    elif funct3 == 0x6: # ORI
-        cpu.registers[rd] = (cpu.registers[rs1] | imm_i) & 0xFFFFFFFF
-    elif funct3 == 0x7: # ANDI
-        cpu.registers[rd] = (cpu.registers[rs1] & imm_i) & 0xFFFFFFFF
-
-def exec_loads(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_i = inst >> 20
-    if imm_i >= 0x800: imm_i -= 0x1000
-    addr = (cpu.registers[rs1] + imm_i) & 0xFFFFFFFF
-
-    if funct3 == 0x0:  # LB
-        cpu.registers[rd] = ram.load_byte(addr) & 0xFFFFFFFF
-    elif funct3 == 0x1:  # LH
-        cpu.registers[rd] = ram.load_half(addr) & 0xFFFFFFFF
-    elif funct3 == 0x2:  # LW
-        cpu.registers[rd] = ram.load_word(addr) & 0xFFFFFFFF
-    elif funct3 == 0x4:  # LBU
-        cpu.registers[rd] = ram.load_byte(addr, signed=False) & 0xFF
-    elif funct3 == 0x5:  # LHU
-        cpu.registers[rd] = ram.load_half(addr, signed=False) & 0xFFFF
+def exec_ADD(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] + cpu.registers[rs2]) & 0xFFFFFFFF
+
+def exec_SUB(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] - cpu.registers[rs2]) & 0xFFFFFFFF
+
+def exec_SLL(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] << (cpu.registers[rs2] & 0x1F)) & 0xFFFFFFFF
+
+def exec_SLT(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = int(signed32(cpu.registers[rs1]) < signed32(cpu.registers[rs2]))
+
+def exec_SLTU(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = int(cpu.registers[rs1] < cpu.registers[rs2])
+
+def exec_XOR(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.registers[rs1] ^ cpu.registers[rs2]
+
+def exec_SRL(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.registers[rs1] >> (cpu.registers[rs2] & 0x1F)
+
+def exec_SRA(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (signed32(cpu.registers[rs1]) >> (cpu.registers[rs2] & 0x1F)) & 0xFFFFFFFF
+
+def exec_OR(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.registers[rs1] | cpu.registers[rs2]
+
+def exec_AND(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.registers[rs1] & cpu.registers[rs2]
+
+# R-type (M extension)
+
+def exec_MUL(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] * cpu.registers[rs2]) & 0xFFFFFFFF  # lower 32 bits are sign-agnostic
+
+def exec_MULH(cpu, rd, rs1, rs2, imm):  # signed × signed, upper 32 bits
+    cpu.registers[rd] = ((signed32(cpu.registers[rs1]) * signed32(cpu.registers[rs2])) >> 32) & 0xFFFFFFFF
+
+def exec_MULHSU(cpu, rd, rs1, rs2, imm):  # signed × unsigned, upper 32 bits
+    cpu.registers[rd] = ((signed32(cpu.registers[rs1]) * cpu.registers[rs2]) >> 32) & 0xFFFFFFFF
+
+def exec_MULHU(cpu, rd, rs1, rs2, imm):  # unsigned × unsigned, upper 32 bits
+    cpu.registers[rd] = (cpu.registers[rs1] * cpu.registers[rs2]) >> 32
+
+def exec_DIV(cpu, rd, rs1, rs2, imm):
+    # Signed division (RISC-V uses truncating division, rounding towards zero)
+    dividend = signed32(cpu.registers[rs1])
+    divisor = signed32(cpu.registers[rs2])
+    if divisor == 0:  # Division by zero: quotient = -1
+        cpu.registers[rd] = 0xFFFFFFFF
+    elif dividend == -0x80000000 and divisor == -1:  # Overflow: return MIN_INT
+        cpu.registers[rd] = 0x80000000
+    else:  # Use truncating division (towards zero), not floor division
+        cpu.registers[rd] = int(dividend / divisor) & 0xFFFFFFFF
+
+def exec_DIVU(cpu, rd, rs1, rs2, imm):
+    divisor = cpu.registers[rs2]
+    if divisor == 0:  # Division by zero: quotient = 2^32 - 1
+        cpu.registers[rd] = 0xFFFFFFFF
     else:
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid funct3=0x{funct3:02x} for LOAD at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
+        cpu.registers[rd] = cpu.registers[rs1] // divisor
+
+def exec_REM(cpu, rd, rs1, rs2, imm):
+    # Signed remainder (RISC-V uses truncating division, rounding towards zero)
+    dividend = signed32(cpu.registers[rs1])
+    divisor = signed32(cpu.registers[rs2])
+    if divisor == 0:  # Division by zero: remainder = dividend
+        cpu.registers[rd] = cpu.registers[rs1]
+    elif dividend == -0x80000000 and divisor == -1:  # Overflow: remainder = 0
+        cpu.registers[rd] = 0
+    else:  # Use truncating remainder: dividend - trunc(dividend/divisor) * divisor
+        cpu.registers[rd] = (dividend - int(dividend / divisor) * divisor) & 0xFFFFFFFF
+
+def exec_REMU(cpu, rd, rs1, rs2, imm):
+    divisor = cpu.registers[rs2]
+    if divisor == 0:  # Division by zero: remainder = dividend
+        cpu.registers[rd] = cpu.registers[rs1]
+    else:
+        cpu.registers[rd] = cpu.registers[rs1] % divisor
 
-def exec_stores(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_s = ((inst >> 7) & 0x1F) | ((inst >> 25) << 5)
-    if imm_s >= 0x800: imm_s -= 0x1000
-    addr = (cpu.registers[rs1] + imm_s) & 0xFFFFFFFF
+# I-type
 
-    if funct3 == 0x0:  # SB
-        ram.store_byte(addr, cpu.registers[rs2] & 0xFF)
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
-    elif funct3 == 0x1:  # SH
-        ram.store_half(addr, cpu.registers[rs2] & 0xFFFF)
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
-    elif funct3 == 0x2:  # SW
-        ram.store_word(addr, cpu.registers[rs2])
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_ADDI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] + imm) & 0xFFFFFFFF
+
+def exec_SLLI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] << imm) & 0xFFFFFFFF
+
+def exec_SLTI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = int(signed32(cpu.registers[rs1]) < imm)
+
+def exec_SLTIU(cpu, rd, rs1, rs2, imm):  # (imm is zero-extended by the decoder)
+    cpu.registers[rd] = int(cpu.registers[rs1] < imm)
+
+def exec_XORI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] ^ imm) & 0xFFFFFFFF
+
+def exec_SRLI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.registers[rs1] >> imm
+
+def exec_SRAI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (signed32(cpu.registers[rs1]) >> imm) & 0xFFFFFFFF
+
+def exec_ORI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] | imm) & 0xFFFFFFFF
+
+def exec_ANDI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.registers[rs1] & imm) & 0xFFFFFFFF
+
+# Loads
+
+def exec_LB(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.ram.load_byte((cpu.registers[rs1] + imm) & 0xFFFFFFFF) & 0xFFFFFFFF
+
+def exec_LH(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.ram.load_half((cpu.registers[rs1] + imm) & 0xFFFFFFFF) & 0xFFFFFFFF
+
+def exec_LW(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.ram.load_word((cpu.registers[rs1] + imm) & 0xFFFFFFFF) & 0xFFFFFFFF
+
+def exec_LBU(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.ram.load_byte((cpu.registers[rs1] + imm) & 0xFFFFFFFF, signed=False) & 0xFF
+
+def exec_LHU(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = cpu.ram.load_half((cpu.registers[rs1] + imm) & 0xFFFFFFFF, signed=False) & 0xFFFF
+
+# Stores (rd is unused)
+
+def exec_SB(cpu, rd, rs1, rs2, imm):
+    cpu.ram.store_byte((cpu.registers[rs1] + imm) & 0xFFFFFFFF, cpu.registers[rs2] & 0xFF)
+    cpu.reservation_valid = False  # Clear any LR/SC reservation
+
+def exec_SH(cpu, rd, rs1, rs2, imm):
+    cpu.ram.store_half((cpu.registers[rs1] + imm) & 0xFFFFFFFF, cpu.registers[rs2] & 0xFFFF)
+    cpu.reservation_valid = False  # Clear any LR/SC reservation
+
+def exec_SW(cpu, rd, rs1, rs2, imm):
+    cpu.ram.store_word((cpu.registers[rs1] + imm) & 0xFFFFFFFF, cpu.registers[rs2])
+    cpu.reservation_valid = False  # Clear any LR/SC reservation
+
+# Branches (rd is unused, imm is the branch offset)
+
+def branch_to(cpu, imm):
+    addr_target = (cpu.pc + imm) & 0xFFFFFFFF
+    # Check alignment: 2-byte (RVC) or 4-byte (no RVC)
+    if addr_target & cpu.alignment_mask:
+        cpu.trap(cause=0, mtval=addr_target)  # unaligned address
     else:
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid funct3=0x{funct3:02x} for STORE at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
+        cpu.next_pc = addr_target
 
-def exec_branches(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    if (
-        (funct3 == 0x0 and cpu.registers[rs1] == cpu.registers[rs2]) or  # BEQ
-        (funct3 == 0x1 and cpu.registers[rs1] != cpu.registers[rs2]) or  # BNE
-        (funct3 == 0x4 and signed32(cpu.registers[rs1]) < signed32(cpu.registers[rs2])) or  # BLT
-        (funct3 == 0x5 and signed32(cpu.registers[rs1]) >= signed32(cpu.registers[rs2])) or  # BGE
-        (funct3 == 0x6 and (cpu.registers[rs1] & 0xFFFFFFFF) < (cpu.registers[rs2] & 0xFFFFFFFF)) or  # BLTU
-        (funct3 == 0x7 and (cpu.registers[rs1] & 0xFFFFFFFF) >= (cpu.registers[rs2] & 0xFFFFFFFF))  # BGEU
-        ):
-        imm_b = (((inst >> 7) & 0x1) << 11)  | \
-                (((inst >> 8) & 0xF) << 1)   | \
-                (((inst >> 25) & 0x3F) << 5) | \
-                ((inst >> 31) << 12)
-        if imm_b >= 0x1000: imm_b -= 0x2000
-        addr_target = (cpu.pc + imm_b) & 0xFFFFFFFF
-        # Check alignment: 2-byte (RVC) or 4-byte (no RVC)
-        if addr_target & cpu.alignment_mask:
-            cpu.trap(cause=0, mtval=addr_target)  # unaligned address
-        else:
-            cpu.next_pc = addr_target
-    elif funct3 == 0x2 or funct3 == 0x3:
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid branch instruction funct3=0x{funct3:X} at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
+def exec_BEQ(cpu, rd, rs1, rs2, imm):
+    if cpu.registers[rs1] == cpu.registers[rs2]:
+        branch_to(cpu, imm)
+
+def exec_BNE(cpu, rd, rs1, rs2, imm):
+    if cpu.registers[rs1] != cpu.registers[rs2]:
+        branch_to(cpu, imm)
+
+def exec_BLT(cpu, rd, rs1, rs2, imm):
+    if signed32(cpu.registers[rs1]) < signed32(cpu.registers[rs2]):
+        branch_to(cpu, imm)
+
+def exec_BGE(cpu, rd, rs1, rs2, imm):
+    if signed32(cpu.registers[rs1]) >= signed32(cpu.registers[rs2]):
+        branch_to(cpu, imm)
 
-def exec_LUI(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_u = inst >> 12
-    cpu.registers[rd] = (imm_u << 12) & 0xFFFFFFFF
+def exec_BLTU(cpu, rd, rs1, rs2, imm):
+    if cpu.registers[rs1] < cpu.registers[rs2]:
+        branch_to(cpu, imm)
 
-def exec_AUIPC(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_u = inst >> 12
-    cpu.registers[rd] = (cpu.pc + (imm_u << 12)) & 0xFFFFFFFF
+def exec_BGEU(cpu, rd, rs1, rs2, imm):
+    if cpu.registers[rs1] >= cpu.registers[rs2]:
+        branch_to(cpu, imm)
 
-def exec_JAL(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    imm_j = (((inst >> 21) & 0x3FF) << 1) | \
-            (((inst >> 20) & 0x1) << 11)  | \
-            (((inst >> 12) & 0xFF) << 12) | \
-            ((inst >> 31) << 20)
-    if imm_j >= 0x100000: imm_j -= 0x200000
+# Upper immediates (imm is the already shifted 20-bit immediate)
 
-    addr_target = (cpu.pc + imm_j) & 0xFFFFFFFF  # (compared to JALR, no need to clear bit 0 here)
+def exec_LUI(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = imm
+
+def exec_AUIPC(cpu, rd, rs1, rs2, imm):
+    cpu.registers[rd] = (cpu.pc + imm) & 0xFFFFFFFF
+
+# Jumps: the rs2 slot holds the instruction size (4 for normal, 2 for compressed) for the return address
+
+def exec_JAL(cpu, rd, rs1, inst_size, imm):
+    addr_target = (cpu.pc + imm) & 0xFFFFFFFF  # (compared to JALR, no need to clear bit 0 here)
 
     if addr_target & cpu.alignment_mask:  # Check alignment
         cpu.trap(cause=0, mtval=addr_target)  # unaligned address
     else:
         if rd != 0:
-            # Use inst_size (4 for normal, 2 for compressed) for return address
             cpu.registers[rd] = (cpu.pc + inst_size) & 0xFFFFFFFF
         cpu.next_pc = addr_target
 
-        #if cpu.logger is not None:
-        #    cpu.logger.debug(f"[JAL] pc=0x{cpu.pc:08X}, rd={rd}, target=0x{cpu.next_pc:08X}, return_addr=0x{(cpu.pc + inst_size) & 0xFFFFFFFF:08X}")
-
-def exec_JALR(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    if funct3 != 0x0:
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid funct3=0x{funct3:X} for JALR at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
-        return
-
-    imm_i = inst >> 20
-    if imm_i >= 0x800: imm_i -= 0x1000
-
-    addr_target = (cpu.registers[rs1] + imm_i) & 0xFFFFFFFE  # clear bit 0
+def exec_JALR(cpu, rd, rs1, inst_size, imm):
+    addr_target = (cpu.registers[rs1] + imm) & 0xFFFFFFFE  # clear bit 0
 
     if addr_target & cpu.alignment_mask:  # Check alignment
         cpu.trap(cause=0, mtval=addr_target)  # unaligned address
     else:
         if rd != 0:
-            # Use inst_size (4 for normal, 2 for compressed) for return address
             cpu.registers[rd] = (cpu.pc + inst_size) & 0xFFFFFFFF
         cpu.next_pc = addr_target
 
-        #if cpu.logger is not None:
-        #    cpu.logger.debug(f"[JALR] jumping to 0x{cpu.next_pc:08X} from rs1=0x{cpu.registers[rs1]:08X}, imm={imm_i}")
+# SYSTEM and MISC-MEM instructions: (inst, rd, rs1, funct3) operands
 
-def exec_SYSTEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
+def exec_SYSTEM(cpu, inst, rd, rs1, funct3):
     if inst == 0x00000073:  # ECALL
         if (cpu.csrs[0x305] == 0) and (cpu.handle_ecall is not None):  # no trap handler, Python handler set
             cpu.handle_ecall()
+            cpu.registers[10] &= 0xFFFFFFFF  # Python handlers may return negative values in a0
             cpu.bypassed_trap_return(cause=11)
         elif cpu.csrs[0x305] != 0:  # trap handler set
             cpu.trap(cause=11)  # cause 11 == machine ECALL
@@ -331,6 +268,7 @@ def exec_SYSTEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
             mstatus = (mstatus & ~(1 << 3)) | (mpie << 3)   # MIE <- MPIE
             mstatus |= (1 << 7)                             # MPIE = 1 (re-arm)
             cpu.csrs[0x300] = mstatus
+            cpu.interrupt_check = True                      # (MIE may have been re-enabled)
     
     elif inst == 0x00100073:  # EBREAK
         # syscalls >= 0xFFFF0000 bypass the rest of the EBREAK logic and are used for logging.
@@ -398,7 +336,6 @@ def exec_SYSTEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
                     cpu.mtimecmp = (cpu.csrs[0x7C3] << 32) | cpu.csrs[0x7C2]
                     cpu.mtimecmp_lo_updated = False
                     cpu.mtimecmp_hi_updated = False
-                    cpu.mtime_countdown = cpu.mtimecmp - cpu.mtime
                     cpu.mtip = (cpu.mtime >= cpu.mtimecmp)
 
         elif funct3 in (0b010, 0b110):  # CSRRS / CSRRSI
@@ -412,6 +349,10 @@ def exec_SYSTEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
         if csr == 0x300:  # MPP field of mstatus is forced to 0b11 as we only support machine mode
             cpu.csrs[0x300] |= 0x00001800  # set bits 12 and 11
 
+        # writes to the interrupt state: pending interrupts are evaluated again after this instruction
+        if csr in cpu.CSR_INTERRUPT and ((funct3 in (0b001, 0b101)) or (rs1_val != 0)):
+            cpu.interrupt_check = True
+
         if rd != 0:
             if csr == 0x7C0:
                 old = cpu.mtime & 0xFFFFFFFF
@@ -425,150 +366,353 @@ def exec_SYSTEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
             cpu.registers[rd] = old
 
     elif inst == 0x10500073:  # WFI
-        pass  # implemented as a no-operation
+        # Without fast-forwarding, implemented as a no-operation (the guest then spins until the interrupt).
+        # With it, if the timer interrupt is enabled in mie and not yet pending, mtime jumps to mtimecmp, so
+        # that the interrupt is pending right after WFI (and taken then, if enabled in mstatus).
+        if cpu.wfi_fast_forward and (cpu.csrs[0x304] & (1<<7)) and cpu.mtime < cpu.mtimecmp:
+            cpu.mtime = cpu.mtimecmp
     
     else:
         if cpu.logger is not None:
             cpu.logger.warning(f"Unhandled system instruction 0x{inst:08X} at PC={cpu.pc:08X}")
         cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
 
-def exec_MISCMEM(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
+def exec_MISCMEM(cpu, inst, rd, rs1, funct3):
     if funct3 in (0b000, 0b001):  # FENCE / FENCE.I
-        pass  # NOP
+        if funct3 == 0b001 and cpu.handle_fence_i is not None:
+            cpu.handle_fence_i()  # FENCE.I: discard all translated code (code may have been modified)
     else:
         if cpu.logger is not None:
             cpu.logger.warning(f"Invalid misc-mem instruction funct3=0x{funct3:X} at PC=0x{cpu.pc:08X}")
         cpu.trap(cause=2, mtval=inst)  # illegal instruction cause
 
-def exec_AMO(cpu, ram, inst, inst_size, rd, funct3, rs1, rs2, funct7):
-    if funct3 != 0x2:  # Only word (W) operations supported in RV32
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid funct3=0x{funct3:X} for AMO at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)
-        return
+# Atomics (A extension, word operations only). In a single-threaded emulator atomics are just
+# read-modify-write sequences: the aq/rl bits (memory ordering) are ignored.
 
-    # Extract funct5 (bits 31:27) to distinguish AMO operations
-    funct5 = (inst >> 27) & 0x1F
-    addr = cpu.registers[rs1] & 0xFFFFFFFF
-
-    # Check word alignment (4-byte boundary)
-    if addr & 0x3:
+def amo_address(cpu, rs1):
+    addr = cpu.registers[rs1]
+    if addr & 0x3:  # Check word alignment (4-byte boundary)
         cpu.trap(cause=6, mtval=addr)  # Store/AMO address misaligned
-        return
-
-    # Single-threaded behavior: atomics are just read-modify-write
-    # In real hardware, aq (bit 26) and rl (bit 25) handle memory ordering
+        return None
+    return addr
 
-    if funct5 == 0b00010:  # LR.W (Load-Reserved Word)
-        # Load word and set reservation
-        val = ram.load_word(addr)
-        cpu.registers[rd] = val
+def exec_LR_W(cpu, rd, rs1, rs2, imm):  # Load-Reserved Word
+    addr = amo_address(cpu, rs1)
+    if addr is not None:
+        cpu.registers[rd] = cpu.ram.load_word(addr)
         cpu.reservation_valid = True
         cpu.reservation_addr = addr
 
-    elif funct5 == 0b00011:  # SC.W (Store-Conditional Word)
-        # Store conditional: succeeds only if reservation is valid and matches address
+def exec_SC_W(cpu, rd, rs1, rs2, imm):  # Store-Conditional Word
+    addr = amo_address(cpu, rs1)
+    if addr is not None:
+        # succeeds only if the reservation is valid and matches the address
         if cpu.reservation_valid and cpu.reservation_addr == addr:
-            ram.store_word(addr, cpu.registers[rs2] & 0xFFFFFFFF)
+            cpu.ram.store_word(addr, cpu.registers[rs2])
             cpu.registers[rd] = 0  # Success
             cpu.reservation_valid = False  # Clear reservation after successful SC
         else:
             cpu.registers[rd] = 1  # Failure
 
-    elif funct5 == 0b00001:  # AMOSWAP.W
+# Read-modify-write AMOs: new value = op(old value, rs2), rd <- old value
+def amo_rmw(cpu, rd, rs1, rs2, op):
+    addr = amo_address(cpu, rs1)
+    if addr is not None:
+        ram = cpu.ram
         old_val = ram.load_word(addr)
-        new_val = cpu.registers[rs2] & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
+        ram.store_word(addr, op(old_val, cpu.registers[rs2]))
         cpu.registers[rd] = old_val
         cpu.reservation_valid = False  # Clear any LR/SC reservation
 
-    elif funct5 == 0b00000:  # AMOADD.W
-        old_val = ram.load_word(addr)
-        new_val = (old_val + cpu.registers[rs2]) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOSWAP_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: val)
 
-    elif funct5 == 0b00100:  # AMOXOR.W
-        old_val = ram.load_word(addr)
-        new_val = (old_val ^ cpu.registers[rs2]) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOADD_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: (old + val) & 0xFFFFFFFF)
 
-    elif funct5 == 0b01100:  # AMOAND.W
-        old_val = ram.load_word(addr)
-        new_val = (old_val & cpu.registers[rs2]) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOXOR_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: old ^ val)
 
-    elif funct5 == 0b01000:  # AMOOR.W
-        old_val = ram.load_word(addr)
-        new_val = (old_val | cpu.registers[rs2]) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOAND_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: old & val)
 
-    elif funct5 == 0b10000:  # AMOMIN.W (signed)
-        old_val = ram.load_word(addr)
-        old_signed = signed32(old_val)
-        rs2_signed = signed32(cpu.registers[rs2])
-        new_val = min(old_signed, rs2_signed) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOOR_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: old | val)
 
-    elif funct5 == 0b10100:  # AMOMAX.W (signed)
-        old_val = ram.load_word(addr)
-        old_signed = signed32(old_val)
-        rs2_signed = signed32(cpu.registers[rs2])
-        new_val = max(old_signed, rs2_signed) & 0xFFFFFFFF
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOMIN_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: min(signed32(old), signed32(val)) & 0xFFFFFFFF)
 
-    elif funct5 == 0b11000:  # AMOMINU.W (unsigned)
-        old_val = ram.load_word(addr) & 0xFFFFFFFF
-        rs2_unsigned = cpu.registers[rs2] & 0xFFFFFFFF
-        new_val = min(old_val, rs2_unsigned)
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOMAX_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, lambda old, val: max(signed32(old), signed32(val)) & 0xFFFFFFFF)
 
-    elif funct5 == 0b11100:  # AMOMAXU.W (unsigned)
-        old_val = ram.load_word(addr) & 0xFFFFFFFF
-        rs2_unsigned = cpu.registers[rs2] & 0xFFFFFFFF
-        new_val = max(old_val, rs2_unsigned)
-        ram.store_word(addr, new_val)
-        cpu.registers[rd] = old_val
-        cpu.reservation_valid = False  # Clear any LR/SC reservation
+def exec_AMOMINU_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, min)
 
-    else:
-        if cpu.logger is not None:
-            cpu.logger.warning(f"Invalid funct5=0x{funct5:02X} for AMO at PC=0x{cpu.pc:08X}")
-        cpu.trap(cause=2, mtval=inst)
-
-# dispatch table for opcode handlers
-opcode_handler = {
-    0x33:   exec_Rtype,     # R-type
-    0x13:   exec_Itype,     # I-type
-    0x03:   exec_loads,     # Loads
-    0x23:   exec_stores,    # Stores
-    0x63:   exec_branches,  # Branches
-    0x37:   exec_LUI,       # LUI
-    0x17:   exec_AUIPC,     # AUIPC
-    0x6F:   exec_JAL,       # JAL
-    0x67:   exec_JALR,      # JALR
-    0x73:   exec_SYSTEM,    # SYSTEM (ECALL/EBREAK)
-    0x0F:   exec_MISCMEM,   # MISC-MEM (FENCE, FENCE.I)
-    0x2F:   exec_AMO        # AMO (A extension: Atomic Memory Operations)
+def exec_AMOMAXU_W(cpu, rd, rs1, rs2, imm):
+    amo_rmw(cpu, rd, rs1, rs2, max)
+
+def exec_AMO_invalid(cpu, inst, message, rs1, unused):  # invalid funct5: alignment is checked first
+    if amo_address(cpu, rs1) is not None:
+        exec_illegal(cpu, inst, message, 0, 0)
+
+# Decode tables, by extension: (funct3, funct7) -> R-type handler, funct3 -> I-type/load/store/branch
+# handler, funct5 -> AMO handler. The decoder uses the tables of the enabled ISA subset (see ISA_TABLES).
+
+RV32I_RTYPE = {
+    (0x0, 0x00): exec_ADD, (0x0, 0x20): exec_SUB, (0x1, 0x00): exec_SLL, (0x2, 0x00): exec_SLT,
+    (0x3, 0x00): exec_SLTU, (0x4, 0x00): exec_XOR, (0x5, 0x00): exec_SRL, (0x5, 0x20): exec_SRA,
+    (0x6, 0x00): exec_OR, (0x7, 0x00): exec_AND,
+}
+RV32M_RTYPE = {
+    (0x0, 0x01): exec_MUL, (0x1, 0x01): exec_MULH, (0x2, 0x01): exec_MULHSU, (0x3, 0x01): exec_MULHU,
+    (0x4, 0x01): exec_DIV, (0x5, 0x01): exec_DIVU, (0x6, 0x01): exec_REM, (0x7, 0x01): exec_REMU,
+}
+RV32I_ITYPE = { 0x0: exec_ADDI, 0x2: exec_SLTI, 0x3: exec_SLTIU, 0x4: exec_XORI, 0x6: exec_ORI, 0x7: exec_ANDI }
+RV32I_LOADS = { 0x0: exec_LB, 0x1: exec_LH, 0x2: exec_LW, 0x4: exec_LBU, 0x5: exec_LHU }
+RV32I_STORES = { 0x0: exec_SB, 0x1: exec_SH, 0x2: exec_SW }
+RV32I_BRANCHES = { 0x0: exec_BEQ, 0x1: exec_BNE, 0x4: exec_BLT, 0x5: exec_BGE, 0x6: exec_BLTU, 0x7: exec_BGEU }
+RV32A_AMO = {
+    0b00010: exec_LR_W, 0b00011: exec_SC_W, 0b00001: exec_AMOSWAP_W, 0b00000: exec_AMOADD_W,
+    0b00100: exec_AMOXOR_W, 0b01100: exec_AMOAND_W, 0b01000: exec_AMOOR_W, 0b10000: exec_AMOMIN_W,
+    0b10100: exec_AMOMAX_W, 0b11000: exec_AMOMINU_W, 0b11100: exec_AMOMAXU_W,
 }
 
+# R-type and AMO tables for each supported ISA subset (C is handled by the RVC expander)
+ISA_TABLES = {
+    'I':   ({**RV32I_RTYPE}, {}),
+    'IM':  ({**RV32I_RTYPE, **RV32M_RTYPE}, {}),
+    'IMA': ({**RV32I_RTYPE, **RV32M_RTYPE}, RV32A_AMO),
+}
+
+# Resolve a (32-bit or expanded compressed) instruction to its leaf handler and operands.
+# Returns a (handler, rd, rs1, rs2, imm) tuple, to be called as handler(cpu, rd, rs1, rs2, imm).
+def decode_leaf(inst, inst_size, isa='IMA'):
+    opcode = inst & 0x7F
+    rd = (inst >> 7) & 0x1F
+    funct3 = (inst >> 12) & 0x7
+    rs1 = (inst >> 15) & 0x1F
+    rs2 = (inst >> 20) & 0x1F
+    funct7 = (inst >> 25) & 0x7F
+    imm_i = inst >> 20
+    if imm_i >= 0x800: imm_i -= 0x1000
+    rtype, amo = ISA_TABLES[isa]
+
+    if opcode == 0x33:  # R-type
+        handler = rtype.get((funct3, funct7))
+        if handler is not None:
+            return (handler, rd, rs1, rs2, 0)
+        what = ('ADD/SUB/MUL', 'SLL/MULH', 'SLT/MULHSU', 'SLTU/MULHU', 'XOR/DIV', 'SRL/SRA/DIVU', 'OR/REM', 'AND/REMU')[funct3]
+        return (exec_illegal, inst, f"Invalid funct7=0x{funct7:02x} for {what} at PC=0x{{pc:08X}}", 0, 0)
+
+    elif opcode == 0x13:  # I-type
+        if funct3 == 0x1:  # SLLI
+            if funct7 == 0x00:
+                return (exec_SLLI, rd, rs1, 0, imm_i & 0x1F)
+            return (exec_illegal, inst, f"Invalid funct7=0x{funct7:02x} for SLLI at PC=0x{{pc:08X}}", 0, 0)
+        elif funct3 == 0x5:  # SRLI/SRAI
+            if funct7 == 0x00:
+                return (exec_SRLI, rd, rs1, 0, imm_i & 0x1F)
+            elif funct7 == 0x20:
+                return (exec_SRAI, rd, rs1, 0, imm_i & 0x1F)
+            return (exec_illegal, inst, f"Invalid funct7=0x{funct7:02x} for SRLI/SRAI at PC=0x{{pc:08X}}", 0, 0)
+        elif funct3 == 0x3:  # SLTIU compares with the sign-extended immediate, taken as unsigned
+            return (exec_SLTIU, rd, rs1, 0, imm_i & 0xFFFFFFFF)
+        return (RV32I_ITYPE[funct3], rd, rs1, 0, imm_i)
+
+    elif opcode == 0x03:  # Loads
+        handler = RV32I_LOADS.get(funct3)
+        if handler is not None:
+            return (handler, rd, rs1, 0, imm_i)
+        return (exec_illegal, inst, f"Invalid funct3=0x{funct3:02x} for LOAD at PC=0x{{pc:08X}}", 0, 0)
+
+    elif opcode == 0x23:  # Stores
+        handler = RV32I_STORES.get(funct3)
+        if handler is not None:
+            imm_s = ((inst >> 7) & 0x1F) | ((inst >> 25) << 5)
+            if imm_s >= 0x800: imm_s -= 0x1000
+            return (handler, 0, rs1, rs2, imm_s)
+        return (exec_illegal, inst, f"Invalid funct3=0x{funct3:02x} for STORE at PC=0x{{pc:08X}}", 0, 0)
+
+    elif opcode == 0x63:  # Branches
+        handler = RV32I_BRANCHES.get(funct3)
+        if handler is not None:
+            imm_b = (((inst >> 7) & 0x1) << 11)  | \
+                    (((inst >> 8) & 0xF) << 1)   | \
+                    (((inst >> 25) & 0x3F) << 5) | \
+                    ((inst >> 31) << 12)
+            if imm_b >= 0x1000: imm_b -= 0x2000
+            return (handler, 0, rs1, rs2, imm_b)
+        return (exec_illegal, inst, f"Invalid branch instruction funct3=0x{funct3:X} at PC=0x{{pc:08X}}", 0, 0)
+
+    elif opcode == 0x37:  # LUI
+        return (exec_LUI, rd, 0, 0, inst & 0xFFFFF000)
+
+    elif opcode == 0x17:  # AUIPC
+        return (exec_AUIPC, rd, 0, 0, inst & 0xFFFFF000)
+
+    elif opcode == 0x6F:  # JAL
+        imm_j = (((inst >> 21) & 0x3FF) << 1) | \
+                (((inst >> 20) & 0x1) << 11)  | \
+                (((inst >> 12) & 0xFF) << 12) | \
+                ((inst >> 31) << 20)
+        if imm_j >= 0x100000: imm_j -= 0x200000
+        return (exec_JAL, rd, 0, inst_size, imm_j)
+
+    elif opcode == 0x67:  # JALR
+        if funct3 == 0x0:
+            return (exec_JALR, rd, rs1, inst_size, imm_i)
+        return (exec_illegal, inst, f"Invalid funct3=0x{funct3:X} for JALR at PC=0x{{pc:08X}}", 0, 0)
+
+    elif opcode == 0x73:  # SYSTEM (ECALL/EBREAK/MRET/WFI/CSR*)
+        return (exec_SYSTEM, inst, rd, rs1, funct3)
+
+    elif opcode == 0x0F:  # MISC-MEM (FENCE, FENCE.I)
+        return (exec_MISCMEM, inst, rd, rs1, funct3)
+
+    elif opcode == 0x2F and amo:  # AMO (A extension)
+        if funct3 != 0x2:  # Only word (W) operations supported in RV32
+            return (exec_illegal, inst, f"Invalid funct3=0x{funct3:X} for AMO at PC=0x{{pc:08X}}", 0, 0)
+        funct5 = (inst >> 27) & 0x1F
+        handler = amo.get(funct5)
+        if handler is not None:
+            return (handler, rd, rs1, rs2, 0)
+        return (exec_AMO_invalid, inst, f"Invalid funct5=0x{funct5:02X} for AMO at PC=0x{{pc:08X}}", rs1, 0)
+
+    return (exec_illegal, inst, f"Invalid instruction at PC={{pc:08X}}: 0x{inst:08X}, opcode=0x{opcode:x}", 0, 0)
+
+# Decode caches.
+#
+# Decode cache entries are (handler, rd, rs1, rs2, imm) tuples, unpacked by the interpreter at each
+# instruction: with their key and immediate they take about 160 bytes each (measured with
+# tracemalloc over the 21763 distinct 32-bit words of micropython.elf), tens of thousands of them
+# for large images. Each cache therefore stores its entries packed into a single integer (see
+# pack_entry), about 70 bytes each with their key, and keeps tuples only for a hot front of at most
+# DECODE_CACHE_HOT entries, the dict looked up by the CPU: a miss of the hot front unpacks the entry
+# (a few shifts, less than decoding the instruction again), and the hot front is emptied when full.
+# 16-bit instructions are decoded on first use from the (memory-mapped) RVC expansion table.
+#
+# With a size limit (set_decode_cache_limit), entries that have not been used recently are dropped
+# and decoded again when needed. Eviction approximates LRU with two generations of packed entries:
+# when the packed entries reach half the limit, they move to an old generation; a miss is served
+# from the old generation (moving the entry back) before decoding, and the entries left in the old
+# generation at the next rotation are dropped.
+#
+# Hits are not counted (the CPU looks entries up directly in DecodeCache.entries), only misses.
+#
+# Entries only depend on the instruction bits, so all the CPU instances decoding the same ISA subset
+# share their caches (see isa_decode_cache), unless created with shared_decode_cache=False.
+DECODE_CACHES = {}          # (isa, instruction size) -> DecodeCache
+DECODE_CACHE_LIMIT = None   # maximum number of entries of each cache (None: unbounded)
+DECODE_CACHE_HOT = 4096     # maximum number of unpacked entries of each cache
+
+PACKED_HANDLERS = []        # handler index in packed entries -> handler
+PACKED_HANDLER_INDEX = {}   # handler -> index
+
+# Pack a decoded entry into handler index | rd << 8 | rs1 << 40 | rs2 << 72 | imm << 104
+# (imm may be negative). Entries with other operands (error messages) are kept as they are.
+def pack_entry(decoded):
+    handler, rd, rs1, rs2, imm = decoded
+    if type(imm) is not int or not all(type(x) is int and 0 <= x <= 0xFFFFFFFF for x in (rd, rs1, rs2)):
+        return decoded
+    index = PACKED_HANDLER_INDEX.get(handler)
+    if index is None:
+        index = PACKED_HANDLER_INDEX[handler] = len(PACKED_HANDLERS)
+        PACKED_HANDLERS.append(handler)
+    return index | rd << 8 | rs1 << 40 | rs2 << 72 | imm << 104
+
+def unpack_entry(packed):
+    if type(packed) is not int:
+        return packed
+    return (PACKED_HANDLERS[packed & 0xFF], (packed >> 8) & 0xFFFFFFFF, (packed >> 40) & 0xFFFFFFFF,
+            (packed >> 72) & 0xFFFFFFFF, packed >> 104)
+
+class DecodeCache:
+    def __init__(self, isa, inst_size):
+        self.isa = isa
+        self.inst_size = inst_size
+        self.entries = {}   # hot front: inst >> 2 (inst16 for 16-bit instructions) -> decoded entry, looked up directly by the CPU
+        self.packed = {}    # all the cached entries (current generation), packed (see pack_entry)
+        self.old = {}       # previous generation of packed entries (with a size limit)
+
+        # statistics (hits of self.entries are not counted, to keep them a single lookup)
+        self.misses = 0     # lookups not found in self.entries
+        self.decodes = 0    # misses that were decoded again (the others were unpacked)
+        self.evictions = 0  # entries dropped because of the size limit
+
+    # Miss of self.entries: returns the decoded entry (adding it to the cache),
+    # or None for an illegal 16-bit instruction
+    def lookup(self, inst):
+        self.misses += 1
+        key = inst >> 2 if self.inst_size == 4 else inst
+        packed = self.packed.get(key)
+        if packed is not None:
+            decoded = unpack_entry(packed)
+        else:
+            packed = self.old.pop(key, None)
+            if packed is not None:
+                decoded = unpack_entry(packed)
+            else:
+                self.decodes += 1
+                if self.inst_size == 2:
+                    inst = expansion_table()[inst]
+                    if not inst:
+                        return None
+                decoded = decode_leaf(inst, self.inst_size, self.isa)
+                packed = pack_entry(decoded)
+            if DECODE_CACHE_LIMIT is not None and len(self.packed) >= max(DECODE_CACHE_LIMIT // 2, 1):
+                self.evictions += len(self.old)
+                self.old = self.packed
+                self.packed = {}
+            self.packed[key] = packed
+        if len(self.entries) >= self.hot_size():
+            self.entries.clear()  # (in place: the dict is shared with the CPUs)
+        self.entries[key] = decoded
+        return decoded
+
+    def hot_size(self):
+        return DECODE_CACHE_HOT if DECODE_CACHE_LIMIT is None else max(min(DECODE_CACHE_HOT, DECODE_CACHE_LIMIT // 2), 1)
+
+    # Add decoded entries in bulk (see decodecache.py)
+    def add(self, entries):
+        self.packed.update({ key: pack_entry(entry) for key, entry in entries.items() })
+        self.trim()
+
+    # Enforce the size limit after it is changed, or after entries are added in bulk
+    def trim(self):
+        if DECODE_CACHE_LIMIT is not None and len(self.packed) + len(self.old) > DECODE_CACHE_LIMIT:
+            items = list(self.old.items()) + list(self.packed.items())
+            keep = max(DECODE_CACHE_LIMIT // 2, 1)
+            self.old = dict(items[-keep:])
+            self.packed = {}
+            self.evictions += len(items) - len(self.old)
+        if len(self.entries) > self.hot_size():
+            self.entries.clear()
+
+    # All the cached entries (both generations), unpacked
+    def snapshot(self):
+        return { key: unpack_entry(entry) for key, entry in (*self.old.items(), *self.packed.items()) }
+
+    def stats(self):
+        return f"{len(self.packed) + len(self.old)} entries ({len(self.entries)} unpacked), {self.misses} misses, {self.decodes} decodes, {self.evictions} evictions"
+
+def isa_decode_cache(isa, inst_size):
+    cache = DECODE_CACHES.get((isa, inst_size))
+    if cache is None:
+        cache = DECODE_CACHES[(isa, inst_size)] = DecodeCache(isa, inst_size)
+    return cache
+
+def set_decode_cache_limit(limit):
+    global DECODE_CACHE_LIMIT
+    DECODE_CACHE_LIMIT = limit
+    for cache in DECODE_CACHES.values():
+        cache.trim()
+
+
+TIMER_NEVER = 1 << 64  # timer deadline when no timer event can happen before the interrupt state changes
 
 # CPU class
 class CPU:
-    def __init__(self, ram, rvc_enabled=False, init_regs=None, logger=None, trace_traps=False):
+    def __init__(self, ram, rvc_enabled=False, init_regs=None, logger=None, trace_traps=False, shared_decode_cache=True):
         # registers
         self.registers = [0] * 32
         if init_regs is not None and init_regs != 'zero':
@@ -621,6 +765,10 @@ class CPU:
         self.CSR_NOWRITE ={ 0x301, 0xB02, 0xB82, 0x7A0, 0x7A1, 0x7A2 }
         # misa, minstret, minstreth, tselect, tdata1, tdata2
 
+        # CSRs holding interrupt state: writes set interrupt_check
+        self.CSR_INTERRUPT = { 0x300, 0x304, 0x344, 0x7C0, 0x7C1, 0x7C2, 0x7C3 }
+        # mstatus, mie, mip, mtime_low, mtime_high, mtimecmp_low, mtimecmp_high
+
         self.mtime = 0x00000000_00000000
         self.mtimecmp = 0xFFFFFFFF_FFFFFFFF
         self.mtime_lo_updated = False
@@ -628,6 +776,11 @@ class CPU:
         self.mtimecmp_lo_updated = False
         self.mtimecmp_hi_updated = False
         self.mtip = False
+        # Pending interrupts are only evaluated when interrupt_check is set (by writes to the interrupt state:
+        # CSRs, MRET, MMIO timer, debugger) or when mtime reaches timer_deadline (see timer_update)
+        self.interrupt_check = True
+        self.timer_deadline = 0
+        self.wfi_fast_forward = False  # WFI skips ahead to the next timer interrupt (set by Machine with the timer)
 
         # LR/SC reservation tracking (A extension)
         self.reservation_valid = False
@@ -682,9 +835,18 @@ class CPU:
             0x8000000B: "Machine external interrupt",
         }
 
-        # instruction decode caches
-        self.decode_cache = {}              # Cache for 32-bit instructions
-        self.decode_cache_compressed = {}   # Cache for 16-bit instructions
+        # instruction decode caches: instruction -> (leaf handler, rd, rs1, rs2, imm), see decode_leaf()
+        self.isa = 'IMA'                    # decoded ISA subset (RV32IMA, C is handled by the RVC expander)
+        if shared_decode_cache:
+            self.decoder = isa_decode_cache(self.isa, 4)
+            self.decoder_compressed = isa_decode_cache(self.isa, 2)
+        else:
+            self.decoder = DecodeCache(self.isa, 4)
+            self.decoder_compressed = DecodeCache(self.isa, 2)
+        self.decode_cache = self.decoder.entries                        # Cache for 32-bit instructions
+        self.decode_cache_compressed = self.decoder_compressed.entries  # Cache for 16-bit instructions
+        self.block_cache = None             # Basic-block translation cache (set up by Machine, see blocks.py)
+        self.handle_fence_i = None          # Discards all translated code on FENCE.I (set up by Machine, see Machine.flush_code)
 
     # Set handler for system calls
     def set_ecall_handler(self, handler):
@@ -693,60 +855,29 @@ class CPU:
     # Instruction execution: 32-bit instructions
     def execute_32(self, inst):
         try:
-            opcode, rd, funct3, rs1, rs2, funct7 = self.decode_cache[inst >> 2]
+            handler, rd, rs1, rs2, imm = self.decode_cache[inst >> 2]
         except KeyError:
-            opcode = inst & 0x7F
-            rd = (inst >> 7) & 0x1F
-            funct3 = (inst >> 12) & 0x7
-            rs1 = (inst >> 15) & 0x1F
-            rs2 = (inst >> 20) & 0x1F
-            funct7 = (inst >> 25) & 0x7F
-            self.decode_cache[inst >> 2] = (opcode, rd, funct3, rs1, rs2, funct7)
+            handler, rd, rs1, rs2, imm = self.decoder.lookup(inst)
 
         self.next_pc = (self.pc + 4) & 0xFFFFFFFF
-
-        if opcode in opcode_handler:
-            (opcode_handler[opcode])(self, self.ram, inst, 4, rd, funct3, rs1, rs2, funct7)
-        else:
-            if self.logger is not None:
-                self.logger.warning(f"Invalid instruction at PC={self.pc:08X}: 0x{inst:08X}, opcode=0x{opcode:x}")
-            self.trap(cause=2, mtval=inst)
-
+        handler(self, rd, rs1, rs2, imm)
         self.registers[0] = 0
 
     # Instruction execution: 16-bit compressed instructions
     def execute_16(self, inst16):
         try:
-            opcode, rd, funct3, rs1, rs2, funct7, expanded_inst = self.decode_cache_compressed[inst16]
+            handler, rd, rs1, rs2, imm = self.decode_cache_compressed[inst16]
         except KeyError:
-            # Expand compressed instruction to 32-bit equivalent
-            expanded_inst, success = expand_compressed(inst16)
-            if not success:
+            decoded = self.decoder_compressed.lookup(inst16)
+            if decoded is None:
                 if self.logger is not None:
                     self.logger.warning(f"Invalid compressed instruction at PC={self.pc:08X}: 0x{inst16:04X}")
                 self.trap(cause=2, mtval=inst16)
                 return
-
-            # Decode the expanded 32-bit instruction
-            opcode = expanded_inst & 0x7F
-            rd = (expanded_inst >> 7) & 0x1F
-            funct3 = (expanded_inst >> 12) & 0x7
-            rs1 = (expanded_inst >> 15) & 0x1F
-            rs2 = (expanded_inst >> 20) & 0x1F
-            funct7 = (expanded_inst >> 25) & 0x7F
-
-            # Cache the expanded and decoded instruction
-            self.decode_cache_compressed[inst16] = (opcode, rd, funct3, rs1, rs2, funct7, expanded_inst)
+            handler, rd, rs1, rs2, imm = decoded
 
         self.next_pc = (self.pc + 2) & 0xFFFFFFFF
-
-        if opcode in opcode_handler:
-            (opcode_handler[opcode])(self, self.ram, expanded_inst, 2, rd, funct3, rs1, rs2, funct7)
-        else:
-            if self.logger is not None:
-                self.logger.warning(f"Invalid instruction at PC={self.pc:08X}: 0x{expanded_inst:08X}, opcode=0x{opcode:x}")
-            self.trap(cause=2, mtval=expanded_inst)
-
+        handler(self, rd, rs1, rs2, imm)
         self.registers[0] = 0
 
     # Instruction execution: auto-detect and dispatch (compatibility wrapper)
@@ -793,12 +924,27 @@ class CPU:
         self.csrs[0x300] |= (1 << 7)        # MPIE = 1
         # (MIE, bit 3, stays unchanged)
 
-    # Machine timer interrupt logic and interrupt checking
+    # Number of instructions (at most limit) that can run before the next timer event, i.e.,
+    # without timer_update() changing MTIP or taking the timer interrupt: the run loops execute them
+    # and add their count to mtime, then call timer_update() after the following instruction.
+    # Only valid until interrupt_check is set (the run loops end their chunks at instructions that may set it).
+    def timer_countdown(self, limit):
+        if self.interrupt_check:
+            return 0
+        return min(limit, max(self.timer_deadline - self.mtime, 0))
+
+    # Machine timer interrupt logic and interrupt checking.
+    # Between timer events, only increments mtime: MTIP and the interrupt enables are evaluated again
+    # when mtime reaches timer_deadline, or after a change to the interrupt state (interrupt_check)
     def timer_update(self):
-        csrs = self.csrs
         mtime = self.mtime
-
         self.mtime = (mtime + 1) # & 0xFFFFFFFF_FFFFFFFF  # the counter should wrap, but it's unlikely to ever happen ;)
+        if mtime < self.timer_deadline and not self.interrupt_check:
+            return
+
+        self.interrupt_check = False
+        self.timer_deadline = TIMER_NEVER
+        csrs = self.csrs
         mtip_asserted = (mtime >= self.mtimecmp)
 
         # Set interrupt pending flag
@@ -810,15 +956,16 @@ class CPU:
             self.mtip = mtip_asserted
 
         if not mtip_asserted:
+            self.timer_deadline = self.mtimecmp  # next event: MTIP asserted
             return
 
         # Check for pending interrupts (only if mstatus.MIE is set)
         if not (csrs[0x300] & (1<<3)):
-            return
+            return  # (MTIP stays asserted until mtimecmp, mtime or mstatus are written)
 
         # Check timer interrupt (MTIP bit 7)
         if csrs[0x304] & (1<<7):
-            self.trap(cause=0x80000007, sync=False)  # Machine timer interrupt
+            self.trap(cause=0x80000007, sync=False)  # Machine timer interrupt (clears mstatus.MIE)
 
     # CPU registers initialization
     def init_registers(self, mode='0x00000000'):
@@ -0,0 +1,99 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+import os, sys, hashlib, marshal, tempfile
+import cpu as cpu_module
+
+# Persistent (on-disk) decode cache.
+#
+# The decode cache of the CPU for 32-bit instructions (CPU.decoder) is saved to a cache
+# directory when the emulator exits, and reloaded at the next start, so that large images
+# (MicroPython, CircuitPython) do not need to decode their code again at every run.
+# (Compressed instructions are not saved: they are decoded from the memory-mapped RVC expansion
+# table.) The CPU decode cache is shared by the whole process (see cpu.DECODE_CACHES), so a saved
+# file may also hold entries of other programs run in the same process: entries only depend on the
+# instruction bits, so they are still valid.
+#
+# Cache files are keyed by the SHA-256 hash of the loaded PT_LOAD segments (address and contents),
+# of the ISA options (RVC and the decoded ISA subset), and of the decoder sources (cpu.py and
+# rvc.py), so that any change to the program or to the decoder selects a different file.
+# Entries are stored with marshal, with each leaf handler replaced by its name: loading a cache
+# file never executes code, and files that cannot be read or contain unknown handlers are ignored.
+# Files are replaced atomically, so that concurrent emulator runs can share the same directory.
+
+CACHE_VERSION = 2  # bump when the format of the cache files changes
+
+DECODER_SOURCES = ('cpu.py', 'rvc.py')
+
+# Leaf handlers that may appear in decode cache entries, by name
+HANDLERS = { name: obj for name, obj in vars(cpu_module).items() if name.startswith('exec_') and callable(obj) }
+
+# Cache key for a program, given its PT_LOAD segments as (address, data) pairs
+def cache_key(segments, rvc, isa):
+    h = hashlib.sha256()
+    h.update(f"v{CACHE_VERSION} {sys.implementation.cache_tag} rvc={int(bool(rvc))} isa={isa}\n".encode())
+
+    src_dir = os.path.dirname(os.path.abspath(__file__))
+    for fname in DECODER_SOURCES:
+        with open(os.path.join(src_dir, fname), 'rb') as f:
+            h.update(hashlib.sha256(f.read()).digest())
+
+    for addr, data in segments:
+        h.update(addr.to_bytes(4, 'little') + len(data).to_bytes(4, 'little'))
+        h.update(data)
+    return h.hexdigest()
+
+class DecodeCacheFile:
+    def __init__(self, cpu, directory, key):
+        self.cpu = cpu
+        self.directory = directory
+        self.path = os.path.join(directory, key + '.decode')
+        self.decodes = 0  # CPU decode count when last loaded/saved
+
+    # Load the cache file (if any) into the CPU decode cache, returns the number of entries loaded
+    def load(self):
+        try:
+            with open(self.path, 'rb') as f:
+                decode_cache = marshal.load(f)
+            decode_cache = { key: (HANDLERS[entry[0]],) + entry[1:] for key, entry in decode_cache.items() }
+        except (OSError, EOFError, ValueError, TypeError, KeyError, IndexError, AttributeError):
+            return 0  # missing or unusable cache file: start from an empty cache
+
+        self.cpu.decoder.add(decode_cache)
+        self.decodes = self.cpu.decoder.decodes
+        return len(decode_cache)
+
+    # Save the CPU decode cache, if new instructions were decoded since it was loaded.
+    # Returns True if the cache file was written.
+    def save(self):
+        if self.cpu.decoder.decodes == self.decodes:
+            return False
+
+        decode_cache = { key: (entry[0].__name__,) + entry[1:] for key, entry in self.cpu.decoder.snapshot().items() }
+
+        os.makedirs(self.directory, exist_ok=True)
+        fd, tmp_path = tempfile.mkstemp(dir=self.directory, suffix='.tmp')
+        try:
+            os.chmod(tmp_path, 0o644)  # (mkstemp creates private files)
+            with os.fdopen(fd, 'wb') as f:
+                marshal.dump(decode_cache, f)
+            os.replace(tmp_path, self.path)  # atomic: readers see either the old or the new file
+        except BaseException:
+            os.unlink(tmp_path)
+            raise
+        self.decodes = self.cpu.decoder.decodes
+        return True
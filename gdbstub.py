@@ -613,6 +613,7 @@ class GDBStub:
                         self.logger.warning(f"Attempted write to read-only CSR 0x{csr_addr:03x}")
                         return 'E02'  # Error: read-only register
                     self.cpu.csrs[csr_addr] = val & 0xFFFFFFFF
+                    self.cpu.interrupt_check = True  # (may change the interrupt state)
                     self.logger.debug(f"Write CSR 0x{csr_addr:03x} = 0x{val:08x}")
                 else:
                     return 'E01'
@@ -845,6 +846,7 @@ class GDBStub:
                     # Write CSR
                     val = int(parts[2], 0)
                     self.cpu.csrs[csr_addr] = val & 0xFFFFFFFF
+                    self.cpu.interrupt_check = True  # (may change the interrupt state)
                     csr_name = self.important_csrs.get(csr_addr, f"0x{csr_addr:03x}")
                     output = f"{csr_name} = 0x{val:08x}\n"
 
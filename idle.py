@@ -0,0 +1,173 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+import select, time
+from functools import partial
+from rvc import expand_compressed_table
+
+# Host-side idling of guest busy-poll loops.
+#
+# Guest drivers wait for devices by spinning on a device register: the MicroPython UART port
+# loops on UART_RX until the RX-empty bit clears, the CircuitPython flash driver loops on the
+# block device status. PollDetector watches the MMIO register reads (by wrapping the read32
+# entries of RAM_MMIO.mmio_ranges): when the same load instruction reads the same value from the
+# same register POLL_THRESHOLD times in a row, with the same register file each time, the guest
+# is likely to be spinning. At the next peripheral update the loop is confirmed by stepping one
+# more iteration through the CPU: it must come back to the load with an identical register file,
+# executing only instructions without side effects (loads, ALU operations, branches and
+# non-linking jumps), so that every further iteration is identical until the register changes.
+#
+# The emulator then parks on the host, with select() on the file descriptors of the polled
+# peripheral (see MMIOPeripheral.wait_fds), up to the next timer interrupt if one can be taken,
+# and at most MAX_PARK seconds. With the timer enabled, mtime is then advanced by the whole
+# iterations the guest would have executed in the meantime at the spin rate measured during
+# detection, stopping short of the next timer interrupt, so that the guest sees the same time
+# (and takes the interrupt at the same instruction) as if it had been spinning.
+#
+# Loops that nothing can end (no file descriptors, no timer interrupt enabled) keep spinning,
+# and bounded runs (see Machine.run) never park, since the instructions stepped and skipped
+# while parking are not counted against their instruction budget.
+
+POLL_THRESHOLD = 16  # identical MMIO reads before a busy-poll loop is suspected
+MAX_POLL_LOOP = 16   # maximum number of instructions per iteration of a busy-poll loop
+MAX_PARK = 1.0       # maximum time parked at once (seconds)
+
+# Opcodes of the instructions without side effects (other than on registers)
+PURE_OPCODES = { 0x03, 0x13, 0x33, 0x37, 0x17, 0x63 }  # LOAD, OP-IMM, OP, LUI, AUIPC, BRANCH
+
+def is_pure(inst):
+    opcode = inst & 0x7F
+    return opcode in PURE_OPCODES or (opcode == 0x6F and (inst >> 7) & 0x1F == 0)  # (JAL x0)
+
+class PollDetector:
+    def __init__(self, cpu, ram, peripherals, timer):
+        self.cpu = cpu
+        self.ram = ram
+        self.peripherals = peripherals  # registered peripherals, to find the file descriptors to wait for
+        self.timer = timer
+        self.key = None         # (pc, addr, value) of the last MMIO read
+        self.registers = None   # register file at the last MMIO read
+        self.count = 0          # number of identical reads in a row
+        self.start_time = 0.0   # host time and mtime at the first of them
+        self.start_mtime = 0
+        self.detected = False   # set when a busy-poll loop is suspected, see park()
+        self.enabled = True     # cleared by Machine.run() during bounded runs
+        self.parks = 0
+
+        # watch the MMIO register reads (same list object, so that RAM_MMIO.load_word sees the change)
+        ram.mmio_ranges[:] = [ (base, end, partial(self.read32, read32), write32)
+                               for base, end, read32, write32 in ram.mmio_ranges ]
+
+    def read32(self, read32, addr):
+        value = read32(addr)
+        cpu = self.cpu
+        key = (cpu.pc, addr, value)
+        if key == self.key and cpu.registers == self.registers:
+            self.count += 1
+            if self.count == POLL_THRESHOLD:
+                self.detected = True
+        else:
+            self.key = key
+            self.registers = cpu.registers[:]
+            self.count = 0
+            self.start_time = time.monotonic()
+            self.start_mtime = cpu.mtime
+        return value
+
+    # Execute one instruction as the MMIO run loops do (16-bit dispatch),
+    # returns False without executing it if it may have side effects
+    def step(self):
+        cpu = self.cpu
+        inst = self.ram.load_word(cpu.pc)
+        if (inst & 0x3) != 0x3:
+            expanded, valid = expand_compressed_table(inst & 0xFFFF)
+            if not (valid and is_pure(expanded)):
+                return False
+            cpu.execute_16(inst & 0xFFFF)
+        else:
+            if not is_pure(inst):
+                return False
+            cpu.execute_32(inst)
+        if self.timer:
+            cpu.timer_update()
+        cpu.pc = cpu.next_pc
+        return True
+
+    # Confirm the suspected loop by stepping through one iteration, from the polling load back to it,
+    # returns the number of instructions per iteration, or 0 if the loop is not a busy-poll loop
+    def confirm(self):
+        cpu = self.cpu
+        key = self.key
+        pc = key[0]
+        for _ in range(MAX_POLL_LOOP):
+            if cpu.pc == pc:
+                break
+            if not self.step():
+                return 0
+        else:
+            return 0
+
+        registers = cpu.registers[:]
+        for n in range(1, MAX_POLL_LOOP + 1):
+            if not self.step():
+                return 0
+            if cpu.pc == pc:
+                return n if (self.key == key and cpu.registers == registers) else 0
+        return 0
+
+    # Called between instructions (at peripheral updates) after a busy-poll loop was suspected:
+    # confirms it and waits on the host until the polled register may change
+    def park(self):
+        self.detected = False
+        addr = self.key[1]
+        if not self.enabled:  # (bounded runs must execute and count every instruction)
+            self.key = None
+            return
+
+        # nothing to wait for if neither a file descriptor nor the timer can end the loop
+        cpu = self.cpu
+        csrs = cpu.csrs
+        timer_pending = self.timer and (csrs[0x300] & (1<<3)) and (csrs[0x304] & (1<<7))  # timer interrupt enabled
+        fds = [ fd for p in self.peripherals if p.REG_BASE <= addr < p.REG_END for fd in getattr(p, 'wait_fds', tuple)() ]
+        if not fds and not timer_pending:
+            self.key = None
+            return
+
+        loop_len = self.confirm()
+        self.key = None  # (start over with the next MMIO read)
+        if not loop_len:
+            return
+
+        timeout = MAX_PARK
+        max_iterations = None
+        if self.timer:
+            rate = (cpu.mtime - self.start_mtime) / max(time.monotonic() - self.start_time, 1e-6)  # instructions/s
+            if timer_pending:
+                max_iterations = (cpu.mtimecmp - cpu.mtime) // loop_len
+                if max_iterations <= 0 or rate <= 0:
+                    return
+                timeout = min(timeout, max_iterations * loop_len / rate)
+
+        start = time.monotonic()
+        select.select(fds, [], [], timeout)
+        self.parks += 1
+
+        if self.timer:
+            iterations = int((time.monotonic() - start) * rate) // loop_len
+            if max_iterations is not None:
+                iterations = min(iterations, max_iterations)
+            cpu.mtime += iterations * loop_len
@@ -0,0 +1,355 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+import operator, struct
+from functools import partial
+
+# Host-native interception of guest library routines.
+#
+# Well-known library routines are recognized by their symbol names in the ELF symbol table:
+#
+# - libc memory and string routines (LibcIntercepts), working directly on slices of RAM.memory
+# - libgcc soft-float routines (SoftFloatIntercepts), computing with host IEEE-754 floats
+#
+# When execution reaches the entry point of one of them, the run loop calls its host-native
+# implementation instead, which takes its arguments from a0-a3, writes the result to a0 (a0-a1
+# for 64-bit results, as in the ilp32 ABI) and returns to ra, as the guest routine would
+# (other caller-saved registers are left untouched). The run loops only check intercepted entry
+# points where they already look code up by PC (see Machine.run):
+#
+# - the native core stops before them, leaving them to Python (see Machine.run_native)
+# - the block cache translates them into single-instruction blocks (see BlockCache.translate)
+# - the predecoded text segment holds them in their slots (see PredecodedText.decode)
+#
+# so runs with interception enabled always use one of these loops. Runs with checks, tracing or
+# GDB debugging always emulate the routines.
+#
+# A routine falls back to emulation (the instruction at the entry point is executed as usual)
+# whenever it cannot give the same result as the guest routine: see the classes below. The one
+# exception is the value of comparisons, of which only the sign is guaranteed (as by the C standard).
+
+# Common calling convention
+class Intercepts:
+    DESCRIPTION = 'routines'
+    WIDE_RESULTS = ()  # names of the routines returning 64-bit results (in a0-a1)
+
+    def __init__(self, cpu, ram, invalidate):
+        self.cpu = cpu
+        self.ram = ram
+        self.invalidate = invalidate  # invalidate(addr, size): discards translated code overwritten by a routine
+        self.calls = 0
+        self.fallbacks = 0
+
+    # Returns {name: routine}. Routines take the argument registers a0-a3, and return the result
+    # or None to fall back to emulation.
+    def routines(self):
+        return {}
+
+    # Returns {entry address: call} for the routines found in symbols ({name: address}).
+    # Each call returns True if it performed the routine, False to fall back to emulation.
+    def entries(self, symbols):
+        return { symbols[name]: partial(self.call, routine, name in self.WIDE_RESULTS)
+                 for name, routine in self.routines().items() if name in symbols }
+
+    # Run a routine on the argument registers, then return from it with its result in a0 (a0-a1)
+    def call(self, routine, wide):
+        cpu = self.cpu
+        regs = cpu.registers
+        ra = regs[1]
+        result = None if ra & cpu.alignment_mask else routine(regs[10], regs[11], regs[12], regs[13])
+        if result is None:
+            self.fallbacks += 1
+            return False
+        regs[10] = result & 0xFFFFFFFF
+        if wide:
+            regs[11] = (result >> 32) & 0xFFFFFFFF
+        cpu.next_pc = ra
+        self.calls += 1
+        return True
+
+# libc memory and string routines.
+# Routines fall back to emulation whenever their arguments reach outside RAM or into MMIO ranges,
+# or when a string is not terminated within RAM: the emulated routine then performs the exact same
+# accesses, including any faults or MMIO side effects. Comparisons return the difference of the
+# first differing bytes: only its sign matches the guest routine (newlib's RISC-V strcmp and
+# MicroPython's memcmp and strcmp return other values of the same sign). strchr falls back for
+# characters outside 0-255, which some libraries do not convert to char.
+# tests/test_intercept_diff.py checks the routines against the emulated ones of an ELF executable.
+
+LIBC_ROUTINES = ('memcpy', 'memmove', 'memset', 'memcmp', 'strlen', 'strcmp', 'strcpy', 'strchr')
+
+# Index of the first differing byte of two equal-length byte strings, or -1 if they are equal
+def first_difference(a, b):
+    diff = int.from_bytes(a, 'little') ^ int.from_bytes(b, 'little')
+    return ((diff & -diff).bit_length() - 1) >> 3 if diff else -1
+
+class LibcIntercepts(Intercepts):
+    DESCRIPTION = 'library routines'
+
+    def __init__(self, cpu, ram, invalidate):
+        super().__init__(cpu, ram, invalidate)
+        self.memory = ram.memory
+        self.base = getattr(ram, 'base_addr', 0)             # guest address of ram.memory[0]
+        self.mmio_ranges = getattr(ram, 'mmio_ranges', ())   # (same list, peripherals may be registered later)
+
+    def routines(self):
+        return { name: getattr(self, name) for name in LIBC_ROUTINES }
+
+    # Offset in ram.memory of guest memory range [addr, addr+n) if it is plain RAM, otherwise None
+    def offset(self, addr, n):
+        offset = addr - self.base
+        if offset < 0 or offset + n > self.ram.size:
+            return None
+        for (lo, hi, *_) in self.mmio_ranges:
+            if lo < addr + n and hi > addr:
+                return None
+        return offset
+
+    # Length of the NUL-terminated string at addr, or None if it is not terminated within plain RAM
+    def string_length(self, addr):
+        offset = self.offset(addr, 1)
+        if offset is None:
+            return None
+        end = self.memory.find(0, offset, self.ram.size)
+        if end < 0 or self.offset(addr, end - offset + 1) is None:
+            return None
+        return end - offset
+
+    # Store data at guest address addr (at offset in ram.memory)
+    def write(self, addr, offset, data):
+        self.memory[offset:offset + len(data)] = data
+        self.cpu.reservation_valid = False  # Clear any LR/SC reservation
+        self.invalidate(addr, len(data))
+
+    # Routines
+
+    def memcpy(self, dst, src, n, unused):
+        if n == 0:
+            return dst
+        d, s = self.offset(dst, n), self.offset(src, n)
+        if d is None or s is None:
+            return None
+        self.write(dst, d, self.memory[s:s + n])
+        return dst
+
+    memmove = memcpy  # (slices are copied before being stored)
+
+    def memset(self, dst, c, n, unused):
+        if n == 0:
+            return dst
+        d = self.offset(dst, n)
+        if d is None:
+            return None
+        self.write(dst, d, bytes((c & 0xFF,)) * n)
+        return dst
+
+    def memcmp(self, a, b, n, unused):
+        if n == 0:
+            return 0
+        i, j = self.offset(a, n), self.offset(b, n)
+        if i is None or j is None:
+            return None
+        k = first_difference(self.memory[i:i + n], self.memory[j:j + n])
+        return 0 if k < 0 else self.memory[i + k] - self.memory[j + k]
+
+    def strlen(self, s, *unused):
+        return self.string_length(s)
+
+    def strcmp(self, a, b, *unused):
+        n = self.string_length(a)
+        if n is None:
+            return None
+        i = self.offset(a, n + 1)
+        j = self.offset(b, 1)
+        if j is None:
+            return None
+        n = min(n + 1, self.ram.size - j)  # (b may end earlier: compare up to the terminator of a, within RAM)
+        k = first_difference(self.memory[i:i + n], self.memory[j:j + n])
+        if k < 0 and self.memory[i + n - 1] != 0:
+            return None  # b runs past the end of RAM
+        if self.offset(b, (n if k < 0 else k + 1)) is None:
+            return None  # b reaches into MMIO
+        return 0 if k < 0 else self.memory[i + k] - self.memory[j + k]
+
+    def strcpy(self, dst, src, *unused):
+        n = self.string_length(src)
+        if n is None:
+            return None
+        d = self.offset(dst, n + 1)
+        if d is None:
+            return None
+        s = src - self.base
+        self.write(dst, d, self.memory[s:s + n + 1])
+        return dst
+
+    def strchr(self, s, c, *unused):
+        n = self.string_length(s)
+        if n is None:
+            return None
+        if c > 0xFF:
+            return None
+        if c == 0:
+            return s + n
+        i = s - self.base
+        k = self.memory.find(c, i, i + n)
+        return 0 if k < 0 else s + (k - i)
+
+# libgcc soft-float routines (single and double precision, ilp32 soft-float ABI).
+# Host arithmetic on Python floats (IEEE-754 doubles, round to nearest even) gives the same bits as
+# the guest routines: single-precision operations are computed in double precision and rounded
+# once more to single precision, which is exact for +, -, * and / (the double result has more than
+# twice the bits of precision needed). Routines fall back to emulation for NaN operands or
+# results (NaN encodings are library-specific), divisions by zero, conversions to integers that
+# overflow, and conversions from 64-bit integers to single precision that would round twice.
+
+F32, F64 = struct.Struct('<f'), struct.Struct('<d')
+U32, U64 = struct.Struct('<I'), struct.Struct('<Q')
+
+def f32(bits):
+    return F32.unpack(U32.pack(bits))[0]
+
+def f64(bits):
+    return F64.unpack(U64.pack(bits))[0]
+
+def bits32(x):  # (rounded to nearest, overflowing to infinity)
+    try:
+        return U32.unpack(F32.pack(x))[0]
+    except OverflowError:
+        return 0xFF800000 if x < 0 else 0x7F800000
+
+def bits64(x):
+    return U64.unpack(F64.pack(x))[0]
+
+def is_nan32(bits):
+    return (bits & 0x7FFFFFFF) > 0x7F800000
+
+def is_nan64(bits):
+    return (bits & 0x7FFFFFFFFFFFFFFF) > 0x7FF0000000000000
+
+def signed32(value):
+    return value - 0x100000000 if value & 0x80000000 else value
+
+def signed64(value):
+    return value - 0x10000000000000000 if value >> 63 else value
+
+# Comparison results of the libgcc routines for ordered operands
+def cmp_eq(x, y):  # __eqXf2, __neXf2: zero if equal
+    return int(x != y)
+
+def cmp_order(x, y):  # __ltXf2, __leXf2, __gtXf2, __geXf2: -1, 0, 1
+    return (x > y) - (x < y)
+
+ARITHMETIC = { 'add': operator.add, 'sub': operator.sub, 'mul': operator.mul, 'div': operator.truediv }
+COMPARISONS = { 'eq': cmp_eq, 'ne': cmp_eq, 'lt': cmp_order, 'le': cmp_order, 'gt': cmp_order, 'ge': cmp_order }
+
+class SoftFloatIntercepts(Intercepts):
+    DESCRIPTION = 'soft-float routines'
+    WIDE_RESULTS = ({ f'__{op}df3' for op in ARITHMETIC } |
+                    { '__negdf2', '__extendsfdf2', '__floatsidf', '__floatunsidf', '__floatdidf', '__floatundidf',
+                      '__fixsfdi', '__fixunssfdi', '__fixdfdi', '__fixunsdfdi' })
+
+    def routines(self):
+        routines = {}
+        for name, op in ARITHMETIC.items():
+            routines[f'__{name}sf3'] = partial(self.arith_sf, op)
+            routines[f'__{name}df3'] = partial(self.arith_df, op)
+        for name, cmp in COMPARISONS.items():
+            routines[f'__{name}sf2'] = partial(self.compare_sf, cmp)
+            routines[f'__{name}df2'] = partial(self.compare_df, cmp)
+        routines.update({
+            '__negsf2': self.neg_sf, '__negdf2': self.neg_df,
+            '__unordsf2': self.unord_sf, '__unorddf2': self.unord_df,
+            '__extendsfdf2': self.extend_sf_df, '__truncdfsf2': self.trunc_df_sf,
+            '__floatsisf': partial(self.float_sf, signed32, 1 << 32), '__floatunsisf': partial(self.float_sf, int, 1 << 32),
+            '__floatdisf': partial(self.float_sf, signed64, 1 << 64), '__floatundisf': partial(self.float_sf, int, 1 << 64),
+            '__floatsidf': partial(self.float_df, signed32, 1 << 32), '__floatunsidf': partial(self.float_df, int, 1 << 32),
+            '__floatdidf': partial(self.float_df, signed64, 1 << 64), '__floatundidf': partial(self.float_df, int, 1 << 64),
+            '__fixsfsi': partial(self.fix_sf, -1 << 31, 1 << 31), '__fixunssfsi': partial(self.fix_sf, 0, 1 << 32),
+            '__fixsfdi': partial(self.fix_sf, -1 << 63, 1 << 63), '__fixunssfdi': partial(self.fix_sf, 0, 1 << 64),
+            '__fixdfsi': partial(self.fix_df, -1 << 31, 1 << 31), '__fixunsdfsi': partial(self.fix_df, 0, 1 << 32),
+            '__fixdfdi': partial(self.fix_df, -1 << 63, 1 << 63), '__fixunsdfdi': partial(self.fix_df, 0, 1 << 64),
+        })
+        return routines
+
+    # Routines (double-precision operands are passed in register pairs, low word first)
+
+    def arith_sf(self, op, a, b, *unused):
+        if is_nan32(a) or is_nan32(b) or (op is operator.truediv and not b & 0x7FFFFFFF):
+            return None
+        x = op(f32(a), f32(b))
+        return None if x != x else bits32(x)
+
+    def arith_df(self, op, a_lo, a_hi, b_lo, b_hi):
+        a, b = a_lo | (a_hi << 32), b_lo | (b_hi << 32)
+        if is_nan64(a) or is_nan64(b) or (op is operator.truediv and not b & 0x7FFFFFFFFFFFFFFF):
+            return None
+        x = op(f64(a), f64(b))
+        return None if x != x else bits64(x)
+
+    def compare_sf(self, cmp, a, b, *unused):
+        if is_nan32(a) or is_nan32(b):
+            return None
+        return cmp(f32(a), f32(b))
+
+    def compare_df(self, cmp, a_lo, a_hi, b_lo, b_hi):
+        a, b = a_lo | (a_hi << 32), b_lo | (b_hi << 32)
+        if is_nan64(a) or is_nan64(b):
+            return None
+        return cmp(f64(a), f64(b))
+
+    def unord_sf(self, a, b, *unused):
+        return int(is_nan32(a) or is_nan32(b))
+
+    def unord_df(self, a_lo, a_hi, b_lo, b_hi):
+        return int(is_nan64(a_lo | (a_hi << 32)) or is_nan64(b_lo | (b_hi << 32)))
+
+    def neg_sf(self, a, *unused):
+        return a ^ 0x80000000
+
+    def neg_df(self, a_lo, a_hi, *unused):
+        return (a_lo | (a_hi << 32)) ^ 0x8000000000000000
+
+    def extend_sf_df(self, a, *unused):
+        return None if is_nan32(a) else bits64(f32(a))
+
+    def trunc_df_sf(self, a_lo, a_hi, *unused):
+        a = a_lo | (a_hi << 32)
+        return None if is_nan64(a) else bits32(f64(a))
+
+    # integer to float conversion, given the signedness and the range of the integer (in a0 or a0-a1)
+    def float_sf(self, sign, limit, lo, hi, *unused):
+        n = sign(lo if limit == 1 << 32 else lo | (hi << 32))
+        if abs(n) > 1 << 53:
+            return None  # (rounding to double first might change the single-precision result)
+        return bits32(float(n))
+
+    def float_df(self, sign, limit, lo, hi, *unused):
+        return bits64(float(sign(lo if limit == 1 << 32 else lo | (hi << 32))))
+
+    # float to integer conversion (truncating), given the range [low, high) of the integer
+    def fix_sf(self, low, high, a, *unused):
+        if (a & 0x7FFFFFFF) >= 0x7F800000:
+            return None  # infinity or NaN
+        n = int(f32(a))
+        return n if low <= n < high else None
+
+    def fix_df(self, low, high, a_lo, a_hi, *unused):
+        a = a_lo | (a_hi << 32)
+        if (a & 0x7FFFFFFFFFFFFFFF) >= 0x7FF0000000000000:
+            return None
+        n = int(f64(a))
+        return n if low <= n < high else None
@@ -0,0 +1,544 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+from functools import partial
+from blocks import is_straight_line
+
+MAX_TRACE_BLOCKS = 16  # maximum number of blocks per trace
+
+# Hot-block compiler.
+#
+# Turns a guest basic block (as decoded by BlockCache.decode_block) into the source code of a
+# Python function, which is then compiled with compile()/exec() and cached by entry PC in place
+# of the interpreted block (code objects are also shared between machines, see CODE_CACHE).
+# The generated code:
+#
+# - keeps the guest registers used by the block in Python locals (x1..x31), loaded on entry and
+#   written back before the terminating instruction, with x0 folded to the constant 0
+# - folds immediates, AUIPC results and branch/jump targets into constants
+# - merges the & 0xFFFFFFFF masks: results of operations that are insensitive to the upper bits
+#   (add, sub, logic ops, left shifts, multiplication) are left unmasked in locals, and are only
+#   normalized when a consumer needs the exact 32-bit value (compares, right shifts, divisions,
+#   write-back)
+# - calls the RAM load/store methods directly, through bound methods passed as default arguments
+# - inlines branches, JAL and JALR; any other terminator (SYSTEM, AMO, MISC-MEM, illegal
+#   instructions) is executed through the regular CPU.execute_32/execute_16 path
+#
+# Traces (see BlockCache.back_edge) are compiled the same way, as a while loop over the blocks
+# along the recorded path from a loop head back to itself: each terminator becomes a guard that
+# leaves the function through a side exit (writing back registers and setting cpu.next_pc) when
+# execution does not follow the recorded path, so that tight guest loops run entirely inside a
+# single Python function.
+#
+# Stores are followed by a side exit to the next instruction, taken when the store modified
+# translated code (BlockCache.epoch changed across the store), which may include the rest of
+# the function.
+#
+# If a memory access raises an exception (e.g., MemoryAccessError or KeyboardInterrupt),
+# registers are written back and cpu.pc is set to the faulting instruction before re-raising,
+# so that error reports show the same state as the interpreter would.
+
+MASK = 0xFFFFFFFF
+
+# Compiled code objects, shared by all the machines in the process: (filename, source) -> code object.
+# The generated source folds in the entry PC and the decoded instructions of the block or trace,
+# so equal sources come from the same code at the same address (e.g., several machines running the
+# same ELF image), and only the per-machine names (CPU, registers, RAM methods) differ at exec().
+CODE_CACHE = {}
+CODE_CACHE_LIMIT = 4096  # oldest entries are dropped beyond this size
+
+# Division helpers (operands are normalized 32-bit values), same semantics as exec_DIV and friends
+def div32(a, b):
+    a = (a ^ 0x80000000) - 0x80000000
+    b = (b ^ 0x80000000) - 0x80000000
+    if b == 0:
+        return 0xFFFFFFFF
+    elif a == -0x80000000 and b == -1:
+        return 0x80000000
+    return int(a / b) & 0xFFFFFFFF
+
+def divu32(a, b):
+    return a // b if b != 0 else 0xFFFFFFFF
+
+def rem32(a, b):
+    sa = (a ^ 0x80000000) - 0x80000000
+    sb = (b ^ 0x80000000) - 0x80000000
+    if sb == 0:
+        return a
+    elif sa == -0x80000000 and sb == -1:
+        return 0
+    return (sa - int(sa / sb) * sb) & 0xFFFFFFFF
+
+def remu32(a, b):
+    return a % b if b != 0 else a
+
+# Constant targets of branches and JAL
+def branch_target(pc, inst):
+    imm_b = (((inst >> 7) & 0x1) << 11) | (((inst >> 8) & 0xF) << 1) | (((inst >> 25) & 0x3F) << 5) | ((inst >> 31) << 12)
+    if imm_b >= 0x1000: imm_b -= 0x2000
+    return (pc + imm_b) & MASK
+
+def jal_target(pc, inst):
+    imm_j = (((inst >> 21) & 0x3FF) << 1) | (((inst >> 20) & 0x1) << 11) | (((inst >> 12) & 0xFF) << 12) | ((inst >> 31) << 20)
+    if imm_j >= 0x100000: imm_j -= 0x200000
+    return (pc + imm_j) & MASK
+
+WRITEBACK = object()  # marks register write-back in side exits (expanded by CodeGen.source)
+
+class BlockCompiler:
+    def __init__(self, block_cache):
+        self.block_cache = block_cache
+        self.cpu = block_cache.cpu
+        self.ram = block_cache.ram
+        self.compiled_count = 0
+        self.trace_count = 0
+        self.shared_count = 0  # compilations served from CODE_CACHE
+
+        # names available to the generated code
+        ram = self.ram
+        self.env = {
+            'cpu': self.cpu, 'regs': self.cpu.registers,
+            'load_byte': ram.load_byte, 'load_half': ram.load_half, 'load_word': ram.load_word,
+            'store_byte': ram.store_byte, 'store_half': ram.store_half, 'store_word': ram.store_word,
+            'div32': div32, 'divu32': divu32, 'rem32': rem32, 'remu32': remu32, 'cache': self.block_cache,
+        }
+
+    # Compile the block starting at start_pc, returns the generated function
+    def compile(self, start_pc):
+        gen = CodeGen(self.cpu, start_pc)
+        gen.emit_block(self.block_cache.decode_block(start_pc), None)
+        self.compiled_count += 1
+        return self.build(gen, f"<jit block 0x{start_pc:08X}>")
+
+    # Compile a loop trace, given as a list of (decoded block, next PC) pairs, the last block
+    # going back to head. Returns the generated function.
+    def compile_trace(self, head, path):
+        gen = CodeGen(self.cpu, head, loop=True)
+        for (insts, next_pc) in path:
+            gen.emit_block(insts, next_pc)
+        gen.close_loop()
+        self.trace_count += 1
+        return self.build(gen, f"<jit trace 0x{head:08X}>")
+
+    def build(self, gen, filename):
+        env = dict(self.env)
+        env.update(gen.consts)
+        namespace = {}
+        key = (filename, gen.source())
+        code = CODE_CACHE.get(key)
+        if code is None:
+            code = CODE_CACHE[key] = compile(key[1], filename, "exec")
+            if len(CODE_CACHE) > CODE_CACHE_LIMIT:
+                del CODE_CACHE[next(iter(CODE_CACHE))]
+        else:
+            self.shared_count += 1
+        exec(code, env, namespace)
+        return namespace['block']
+
+    # Returns True if a trace can continue past the given block terminator
+    # (branches and jumps with valid targets, or blocks split at MAX_BLOCK_LEN)
+    def traceable(self, decoded):
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+        if inst is None or not success:
+            return False
+        if opcode == 0x63:
+            return funct3 not in (0x2, 0x3) and not (branch_target(pc, e) & self.cpu.alignment_mask)
+        elif opcode == 0x6F:
+            return not (jal_target(pc, e) & self.cpu.alignment_mask)
+        elif opcode == 0x67:
+            return funct3 == 0x0
+        return is_straight_line(opcode, rd, funct3, funct7)
+
+    # Record the path taken from loop head pc, executing it, and install it as a trace if it
+    # returns to the head. Recording stops early when the path reaches another trace, an intercepted
+    # routine or a terminator that cannot be traced through, or after MAX_TRACE_BLOCKS blocks.
+    def record_trace(self, head):
+        cache = self.block_cache
+        cpu = self.cpu
+        blocks = cache.blocks
+        epoch = cache.epoch
+        path = []
+
+        pc = head
+        while True:
+            try:
+                body, term_pc, term = blocks[pc]
+            except KeyError:
+                body, term_pc, term = cache.translate(pc)
+
+            for op_pc, op in body:
+                cpu.pc = op_pc
+                op()
+
+            cpu.pc = term_pc
+            term()
+
+            insts = cache.decode_block(pc)
+            next_pc = cpu.next_pc
+            path.append((insts, next_pc))
+            if next_pc == head or next_pc in cache.traces or next_pc in cache.intercepts or len(path) == MAX_TRACE_BLOCKS or not self.traceable(insts[-1]):
+                break
+            pc = cpu.pc = next_pc
+
+        # only closed loops are worth a trace (other back-edges are often calls and returns),
+        # and the recording is useless if code was modified meanwhile
+        if next_pc != head or not self.traceable(path[-1][0][-1]) or cache.epoch != epoch:
+            return
+
+        ranges = tuple((insts[0][0], insts[-1][0] + insts[-1][2]) for (insts, _) in path)
+        cache.install(head, ranges, ((), head, self.compile_trace(head, path)))
+        cache.traces.add(head)
+
+# Source code generator for a block or a trace
+class CodeGen:
+    def __init__(self, cpu, start_pc, loop=False):
+        self.cpu = cpu
+        self.start_pc = start_pc
+        self.lines = []          # function body (inside the try: statement), with WRITEBACK markers
+        self.tail = []           # terminator code (after register write-back)
+        self.used = set()        # registers held in locals
+        self.dirty = set()       # registers modified by the block
+        self.normalized = {}     # register -> True if the local holds a value in [0, 2^32)
+        self.consts = {}         # extra names (bound terminator calls)
+        self.uses = set()        # helper names referenced by the generated code
+        self.has_store = False
+        self.may_raise = False
+        self.loop = loop         # True for traces looping back to their head
+
+    # Returns the expression of register n, without normalization
+    def reg(self, n):
+        if n == 0:
+            return '0'
+        if n not in self.used:
+            self.used.add(n)
+            self.normalized[n] = True
+        return f'x{n}'
+
+    # Returns the expression of register n as a normalized (unsigned 32-bit) value
+    def ureg(self, n):
+        name = self.reg(n)
+        if n != 0 and not self.normalized[n]:
+            self.lines.append(f'{name} &= 0xFFFFFFFF')
+            self.normalized[n] = True
+        return name
+
+    # Returns the expression of register n as a signed 32-bit value
+    def sreg(self, n):
+        name = self.ureg(n)
+        return '0' if n == 0 else f'(({name} ^ 0x80000000) - 0x80000000)'
+
+    def assign(self, rd, expr, normalized):
+        name = self.reg(rd)
+        self.lines.append(f'{name} = {expr}')
+        self.normalized[rd] = normalized
+        self.dirty.add(rd)
+
+    def use(self, name):
+        self.uses.add(name)
+        return name
+
+    def emit_inst(self, decoded):
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+        imm_i = e >> 20
+        if imm_i >= 0x800: imm_i -= 0x1000
+
+        if opcode == 0x33:  # R-type
+            if rd == 0:
+                return
+            if funct7 == 0x01:  # M extension
+                if funct3 == 0x0:    # MUL
+                    self.assign(rd, f'{self.reg(rs1)} * {self.reg(rs2)}', False)
+                elif funct3 == 0x1:  # MULH
+                    self.assign(rd, f'({self.sreg(rs1)} * {self.sreg(rs2)}) >> 32', False)
+                elif funct3 == 0x2:  # MULHSU
+                    self.assign(rd, f'({self.sreg(rs1)} * {self.ureg(rs2)}) >> 32', False)
+                elif funct3 == 0x3:  # MULHU
+                    self.assign(rd, f'({self.ureg(rs1)} * {self.ureg(rs2)}) >> 32', True)
+                else:                # DIV, DIVU, REM, REMU
+                    helper = self.use(('div32', 'divu32', 'rem32', 'remu32')[funct3 - 4])
+                    self.assign(rd, f'{helper}({self.ureg(rs1)}, {self.ureg(rs2)})', True)
+            elif funct3 == 0x0:      # ADD/SUB
+                op = '-' if funct7 == 0x20 else '+'
+                self.assign(rd, f'{self.reg(rs1)} {op} {self.reg(rs2)}', False)
+            elif funct3 == 0x1:      # SLL
+                self.assign(rd, f'{self.reg(rs1)} << ({self.reg(rs2)} & 0x1F)', False)
+            elif funct3 == 0x2:      # SLT
+                self.assign(rd, f'1 if {self.sreg(rs1)} < {self.sreg(rs2)} else 0', True)
+            elif funct3 == 0x3:      # SLTU
+                self.assign(rd, f'1 if {self.ureg(rs1)} < {self.ureg(rs2)} else 0', True)
+            elif funct3 == 0x4:      # XOR
+                self.assign(rd, f'{self.reg(rs1)} ^ {self.reg(rs2)}', False)
+            elif funct3 == 0x5:      # SRL/SRA
+                if funct7 == 0x20:
+                    self.assign(rd, f'{self.sreg(rs1)} >> ({self.reg(rs2)} & 0x1F)', False)
+                else:
+                    self.assign(rd, f'{self.ureg(rs1)} >> ({self.reg(rs2)} & 0x1F)', True)
+            elif funct3 == 0x6:      # OR
+                self.assign(rd, f'{self.reg(rs1)} | {self.reg(rs2)}', False)
+            else:                    # AND
+                self.assign(rd, f'{self.reg(rs1)} & {self.reg(rs2)}', False)
+
+        elif opcode == 0x13:  # I-type
+            if rd == 0:
+                return
+            if funct3 == 0x0:    # ADDI
+                if imm_i == 0:   # MV
+                    self.assign(rd, self.reg(rs1), rs1 == 0 or self.normalized[rs1])
+                else:
+                    self.assign(rd, f'{self.reg(rs1)} + {imm_i}', False)
+            elif funct3 == 0x1:  # SLLI
+                self.assign(rd, f'{self.reg(rs1)} << {imm_i & 0x1F}', False)
+            elif funct3 == 0x2:  # SLTI
+                self.assign(rd, f'1 if {self.sreg(rs1)} < {imm_i} else 0', True)
+            elif funct3 == 0x3:  # SLTIU
+                self.assign(rd, f'1 if {self.ureg(rs1)} < {imm_i & MASK} else 0', True)
+            elif funct3 == 0x4:  # XORI
+                self.assign(rd, f'{self.reg(rs1)} ^ {imm_i}', False)
+            elif funct3 == 0x5:  # SRLI/SRAI
+                if funct7 == 0x20:
+                    self.assign(rd, f'{self.sreg(rs1)} >> {imm_i & 0x1F}', False)
+                else:
+                    self.assign(rd, f'{self.ureg(rs1)} >> {imm_i & 0x1F}', True)
+            elif funct3 == 0x6:  # ORI
+                self.assign(rd, f'{self.reg(rs1)} | {imm_i}', False)
+            else:                # ANDI (the result is normalized for non-negative immediates)
+                self.assign(rd, f'{self.reg(rs1)} & {imm_i}', imm_i >= 0)
+
+        elif opcode == 0x37:  # LUI
+            if rd != 0:
+                self.assign(rd, f'{e & 0xFFFFF000}', True)
+
+        elif opcode == 0x17:  # AUIPC
+            if rd != 0:
+                self.assign(rd, f'{(pc + (e & 0xFFFFF000)) & MASK}', True)
+
+        elif opcode == 0x03:  # Loads
+            self.may_raise = True
+            self.lines.append(f'pc = {pc}')
+            addr = self.addr_expr(rs1, imm_i)
+            if funct3 == 0x0:    # LB
+                self.assign(rd, f'{self.use("load_byte")}({addr}) & 0xFFFFFFFF', True)
+            elif funct3 == 0x1:  # LH
+                self.assign(rd, f'{self.use("load_half")}({addr}) & 0xFFFFFFFF', True)
+            elif funct3 == 0x2:  # LW
+                self.assign(rd, f'{self.use("load_word")}({addr})', False)
+            elif funct3 == 0x4:  # LBU
+                self.assign(rd, f'{self.use("load_byte")}({addr}, False)', True)
+            else:                # LHU
+                self.assign(rd, f'{self.use("load_half")}({addr}, False)', True)
+
+        elif opcode == 0x23:  # Stores
+            self.may_raise = True
+            imm_s = ((e >> 7) & 0x1F) | ((e >> 25) << 5)
+            if imm_s >= 0x800: imm_s -= 0x1000
+            self.lines.append(f'pc = {pc}')
+            self.lines.append(f'a = {self.addr_expr(rs1, imm_s)}')
+            self.lines.append(f'epoch = {self.use("cache")}.epoch')
+            value = self.reg(rs2)
+            if funct3 == 0x0:    # SB
+                self.lines.append(f'{self.use("store_byte")}(a, {value} & 0xFF)')
+            elif funct3 == 0x1:  # SH
+                self.lines.append(f'{self.use("store_half")}(a, {value} & 0xFFFF)')
+            else:                # SW
+                self.lines.append(f'{self.use("store_word")}(a, {value})')
+            if not self.has_store:
+                self.lines.append('cpu.reservation_valid = False')  # clear any LR/SC reservation
+                self.has_store = True
+            self.lines.append('if cache.epoch != epoch:')  # leave if the store modified translated code
+            self.lines.append(WRITEBACK)
+            self.lines.append(f'    cpu.next_pc = {(pc + inst_size) & MASK}')
+            self.lines.append('    return')
+
+    def addr_expr(self, rs1, imm):
+        if rs1 == 0:
+            return f'{imm & MASK}'
+        name = self.reg(rs1)
+        if imm == 0 and self.normalized[rs1]:
+            return name
+        return f'({name} + {imm}) & 0xFFFFFFFF'
+
+    # Emit the instructions of a decoded block. With next_pc=None the terminator ends the generated
+    # function; otherwise execution continues at next_pc, and a side exit is taken if the terminator
+    # goes elsewhere.
+    def emit_block(self, insts, next_pc):
+        for decoded in insts[:-1]:
+            self.emit_inst(decoded)
+        if next_pc is None:
+            self.emit_terminator(insts[-1])
+        else:
+            self.emit_guard(insts[-1], next_pc)
+
+    # Side exit: write back registers and leave the function when cond is true
+    # (in traces, exits to the loop head just start the next iteration)
+    def emit_exit(self, cond, next_pc):
+        self.lines.append(f'if {cond}:')
+        if self.loop and next_pc == self.start_pc:
+            self.lines.extend(f'    x{n} &= 0xFFFFFFFF' for n in sorted(self.used) if not self.normalized[n])
+            self.lines.append('    continue')
+            return
+        self.lines.append(WRITEBACK)
+        self.lines.append(f'    cpu.next_pc = {next_pc}')
+        self.lines.append('    return')
+
+    def branch_cond(self, funct3, rs1, rs2):
+        if funct3 == 0x0:
+            return f'{self.ureg(rs1)} == {self.ureg(rs2)}'
+        elif funct3 == 0x1:
+            return f'{self.ureg(rs1)} != {self.ureg(rs2)}'
+        elif funct3 == 0x4:
+            return f'{self.sreg(rs1)} < {self.sreg(rs2)}'
+        elif funct3 == 0x5:
+            return f'{self.sreg(rs1)} >= {self.sreg(rs2)}'
+        elif funct3 == 0x6:
+            return f'{self.ureg(rs1)} < {self.ureg(rs2)}'
+        else:
+            return f'{self.ureg(rs1)} >= {self.ureg(rs2)}'
+
+    # Terminator of a block in the middle of a trace (see BlockCompiler.traceable)
+    def emit_guard(self, decoded, next_pc):
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+        fall_through = (pc + inst_size) & MASK
+
+        if opcode == 0x63:    # Branches: exit if the branch does not go the recorded way
+            target = branch_target(pc, e)
+            if target != fall_through:
+                cond = self.branch_cond(funct3, rs1, rs2)
+                if next_pc == target:
+                    self.emit_exit(f'not ({cond})', fall_through)
+                else:
+                    self.emit_exit(cond, target)
+
+        elif opcode == 0x6F:  # JAL
+            if rd != 0:
+                self.assign(rd, f'{fall_through}', True)
+
+        elif opcode == 0x67:  # JALR: exit if the target is not the recorded one
+            imm_i = e >> 20
+            if imm_i >= 0x800: imm_i -= 0x1000
+            self.lines.append(f't = ({self.reg(rs1)} + {imm_i}) & 0xFFFFFFFE')
+            self.lines.append(f'if t != {next_pc}:')
+            self.lines.append(WRITEBACK)
+            if self.cpu.alignment_mask & 0x2:
+                self.lines.append('    if t & 0x2:')
+                self.lines.append(f'        pc = cpu.pc = {pc}')
+                self.lines.append('        cpu.trap(cause=0, mtval=t)')
+                self.lines.append('        return')
+            if rd != 0:
+                self.lines.append(f'    regs[{rd}] = {fall_through}')
+            self.lines.append('    cpu.next_pc = t')
+            self.lines.append('    return')
+            if rd != 0:
+                self.assign(rd, f'{fall_through}', True)
+
+        else:                 # block split at MAX_BLOCK_LEN
+            self.emit_inst(decoded)
+
+    # End of a loop trace: all registers must be normalized when going back to the head
+    def close_loop(self):
+        for n in sorted(self.used):
+            if not self.normalized[n]:
+                self.lines.append(f'x{n} &= 0xFFFFFFFF')
+                self.normalized[n] = True
+
+    # Terminating instruction: inline branches and jumps, everything else goes through CPU.execute_*
+    def emit_terminator(self, decoded):
+        (pc, inst, inst_size, e, success, opcode, rd, funct3, rs1, rs2, funct7) = decoded
+        alignment_mask = self.cpu.alignment_mask
+
+        if inst is None:  # fall through to an instruction that cannot be fetched (yet)
+            self.tail.append(f'cpu.next_pc = {pc}')
+            return
+
+        if success and is_straight_line(opcode, rd, funct3, funct7):  # block split at MAX_BLOCK_LEN
+            self.emit_inst(decoded)
+            self.tail.append(f'cpu.next_pc = {(pc + inst_size) & MASK}')
+            return
+
+        if success and opcode == 0x63 and funct3 not in (0x2, 0x3):  # Branches
+            target = branch_target(pc, e)
+            if not (target & alignment_mask):
+                cond = self.branch_cond(funct3, rs1, rs2)
+                self.tail.append(f'cpu.next_pc = {target} if {cond} else {(pc + inst_size) & MASK}')
+                return
+
+        elif success and opcode == 0x6F:  # JAL
+            target = jal_target(pc, e)
+            if not (target & alignment_mask):
+                if rd != 0:
+                    self.assign(rd, f'{(pc + inst_size) & MASK}', True)
+                self.tail.append(f'cpu.next_pc = {target}')
+                return
+
+        elif success and opcode == 0x67 and funct3 == 0x0:  # JALR
+            imm_i = e >> 20
+            if imm_i >= 0x800: imm_i -= 0x1000
+            self.tail.append(f't = ({self.reg(rs1)} + {imm_i}) & 0xFFFFFFFE')
+            if alignment_mask & 0x2:  # misaligned target: trap before writing rd
+                self.tail.append('if t & 0x2:')
+                self.tail.append(f'    cpu.pc = {pc}')
+                self.tail.append('    cpu.trap(cause=0, mtval=t)')
+                self.tail.append('    return')
+            if rd != 0:
+                self.tail.append(f'regs[{rd}] = {(pc + inst_size) & MASK}')
+            self.tail.append('cpu.next_pc = t')
+            return
+
+        # everything else (or branches/jumps to misaligned constant targets)
+        execute = self.cpu.execute_16 if inst_size == 2 else self.cpu.execute_32
+        self.consts['term'] = partial(execute, inst)
+        self.uses.add('term')
+        self.tail.append(f'cpu.pc = {pc}')
+        self.tail.append('term()')
+
+    def source(self):
+        regs = sorted(self.used)
+        args = ['cpu=cpu', 'regs=regs'] + [f'{name}={name}' for name in sorted(self.uses)]
+        out = [f'def block({", ".join(args)}):']
+        for n in regs:
+            out.append(f'    x{n} = regs[{n}]')
+
+        # side exits write back all the registers modified anywhere in the trace
+        exit_writeback = [f'regs[{n}] = x{n} & 0xFFFFFFFF' for n in sorted(self.dirty)]
+
+        indent = '    '
+        if self.may_raise or self.loop:
+            # on exceptions, write back registers and report the faulting PC
+            out.append(f'    pc = {self.start_pc}')
+            out.append('    try:')
+            indent += '    '
+        if self.loop:
+            out.append(f'{indent}while True:')
+            indent += '    '
+        for line in self.lines:
+            if line is WRITEBACK:
+                out.extend(f'{indent}    {wb}' for wb in exit_writeback)
+            else:
+                out.append(f'{indent}{line}')
+        if self.loop and not self.lines:
+            out.append(f'{indent}pass')
+        if self.may_raise or self.loop:
+            out.append('    except BaseException:')
+            for n in regs:
+                out.append(f'        regs[{n}] = x{n} & 0xFFFFFFFF')
+            out.append('        cpu.pc = pc')
+            out.append('        raise')
+
+        if not self.loop:
+            for n in sorted(self.dirty):
+                out.append(f'    regs[{n}] = x{n}' if self.normalized[n] else f'    regs[{n}] = x{n} & 0xFFFFFFFF')
+            out.extend(f'    {line}' for line in self.tail)
+        return '\n'.join(out) + '\n'
@@ -0,0 +1,153 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+
+from machine import DebugBreak
+from ram import MemoryAccessError
+
+# Generated per-instruction run loops.
+#
+# The run loops that must see every instruction (checks, tracing, register logging, GDB debugging,
+# instruction budgets) are generated as Python source from the set of active features, compiled
+# once per feature combination and cached, so that each combination gets a straight-line loop body
+# without conditionals on the features it does not use. Loops without any of these features are
+# the hand-written Machine.run_* loops, which handle the timer and MMIO per chunk of instructions.
+#
+# A generated loop is a function loop(machine, gdb_stub=None, budget=0, until_pc=None), which runs until:
+# - execution reaches the stop_checks PC after checks have started ('stop' feature, see Machine.run)
+# - budget instructions have been executed ('budget' feature)
+# - execution reaches until_pc, after at least one instruction ('until' feature, with 'budget')
+# - GDB stops the target or a breakpoint is hit ('gdb' feature, raises DebugBreak)
+# or until an exception is raised by the emulated program (e.g., ExecutionTerminated).
+# With the 'budget' feature, the loop returns the remaining budget (see Machine.run_until).
+#
+# Instructions are fetched with a single load_word(), falling back to 16-bit fetches at the end of
+# memory, where the interpreter must not read past a compressed instruction.
+
+DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
+INTERRUPT_CHECK_MASK = 0xFFF  # check for interrupts from GDB every 4096 cycles (~2ms)
+
+FEATURES = ('compressed', 'timer', 'mmio', 'regs', 'trace', 'check_inv', 'gdb', 'stop', 'budget', 'until')
+
+LOOPS = {}  # tuple of active features -> generated loop function
+
+# Instruction fetch when load_word() fails at the end of memory: 16 bits, then the upper half of a 32-bit instruction
+def fetch_halves(ram, pc):
+    inst = ram.load_half(pc, signed=False)
+    if (inst & 0x3) == 0x3:
+        inst |= ram.load_half(pc + 2, signed=False) << 16
+    return inst
+
+# Returns the run loop for the given features (keyword arguments named as in FEATURES)
+def generated_loop(**features):
+    key = tuple(sorted(name for name, enabled in features.items() if enabled))
+    loop = LOOPS.get(key)
+    if loop is None:
+        unknown = set(key) - set(FEATURES)
+        if unknown:
+            raise ValueError(f"Unknown run loop features: {', '.join(sorted(unknown))}")
+        namespace = {}
+        name = '+'.join(key) or 'plain'
+        exec(compile(loop_source(set(key)), f"<run loop {name}>", "exec"),
+             { 'DebugBreak': DebugBreak, 'MemoryAccessError': MemoryAccessError, 'fetch_halves': fetch_halves }, namespace)
+        loop = LOOPS[key] = namespace['loop']
+    return loop
+
+# Python source of the run loop for a set of features
+def loop_source(features):
+    on = features.__contains__
+    src = ['def loop(machine, gdb_stub=None, budget=0, until_pc=None):',
+           '    cpu = machine.cpu',
+           '    ram = machine.ram',
+           '    load_word = ram.load_word',
+           '    execute_32 = cpu.execute_32']
+    if on('compressed'):
+        src.append('    execute_16 = cpu.execute_16')
+    if on('regs') or on('trace') or on('stop'):
+        src.append('    logger = machine.logger')
+    if on('regs'):
+        src.append('    regformatter = machine.make_regformatter_lambda(machine.regs)')
+    if on('trace'):
+        src.append('    symbol_dict = machine.symbol_dict')
+    if on('check_inv'):
+        src.append('    check_invariants = machine.check_invariants')
+    if on('mmio'):
+        src += ['    peripherals_run = machine.peripherals_run',
+                '    div = 0']
+    if on('gdb'):
+        src += ['    is_breakpoint = gdb_stub.is_breakpoint',
+                '    cycle_count = 0']
+    if on('stop'):
+        src.append('    stop_pc = machine.stop_checks_pc')
+
+    src.append('    while gdb_stub.running:' if on('gdb') else '    while True:')
+    src.append('        pc = cpu.pc')
+    if on('gdb'):
+        src += ['        if is_breakpoint(pc):',
+                '            raise DebugBreak(f"Breakpoint at 0x{pc:08x}", signal=5)  # SIGTRAP',
+                '        cycle_count += 1',
+                f'        if cycle_count & {INTERRUPT_CHECK_MASK} == 0 and gdb_stub.check_for_interrupt():',
+                '            gdb_stub.running = False',
+                '            raise DebugBreak("Interrupted by user", signal=2)  # SIGINT']
+    if on('regs'):
+        src.append('        logger.debug("REGS: " + regformatter(cpu))')
+    if on('check_inv'):
+        src.append('        check_invariants()')
+    if on('trace'):
+        src += ['        if pc in symbol_dict:',
+                '            logger.debug(f"FUNC {symbol_dict[pc]}, PC={pc:08X}")']
+
+    src += ['        try:',
+            '            inst = load_word(pc)',
+            '        except MemoryAccessError:',
+            '            inst = fetch_halves(ram, pc)']
+    if on('compressed'):
+        src += ['        if (inst & 0x3) == 0x3:',
+                '            execute_32(inst)',
+                '        else:',
+                '            execute_16(inst & 0xFFFF)']
+    else:
+        src.append('        execute_32(inst)')
+
+    if on('timer'):  # CPU.timer_update(), with the common case (no timer event) inlined
+        src += ['        mtime = cpu.mtime',
+                '        if mtime < cpu.timer_deadline and not cpu.interrupt_check:',
+                '            cpu.mtime = mtime + 1',
+                '        else:',
+                '            cpu.timer_update()']
+    src.append('        cpu.pc = cpu.next_pc')
+
+    if on('mmio'):
+        src += ['        div += 1',
+                f'        if div & {DIV_MASK} == 0:',
+                '            peripherals_run()',
+                '            div = 0']
+    if on('budget'):
+        src.append('        budget -= 1')
+    if on('stop'):
+        src += ['        if cpu.pc == stop_pc and machine.check_enable:',
+                '            machine.check_enable = False',
+                '            if logger is not None:',
+                '                logger.debug(f"Checking stopped ({machine.stop_checks}) at PC=0x{stop_pc:08X}")',
+                '            return budget']
+    if on('until'):
+        src += ['        if cpu.pc == until_pc:',
+                '            return budget']
+    if on('budget'):
+        src += ['        if budget <= 0:',
+                '            return 0']
+    return '\n'.join(src) + '\n'
@@ -16,6 +16,9 @@
 #
 
 from elftools.elf.elffile import ELFFile
+from rvc import expand_compressed_table
+from intercept import LibcIntercepts, SoftFloatIntercepts
+from idle import PollDetector
 
 class MachineError(Exception):
     pass
@@ -29,6 +32,14 @@ class InvariantViolationError(MachineError):
 class ExecutionTerminated(MachineError):
     pass
 
+# Raised by the fast run loops at the start_checks PC, to hand off execution to run_with_checks()
+class ChecksTriggered(MachineError):
+    pass
+
+# Raised by the stores of translated blocks that modified translated code (see blocks.py), to leave the block
+class CodeModified(MachineError):
+    pass
+
 class DebugBreak(MachineError):
     """Exception raised to break out of execution loop for GDB debugging.
 
@@ -42,7 +53,7 @@ class DebugBreak(MachineError):
         super().__init__(reason)
 
 class Machine:
-    def __init__(self, cpu, ram, timer=False, mmio=False, rvc=False, logger=None, trace=False, regs=None, check_inv=False, start_checks=None):
+    def __init__(self, cpu, ram, timer=False, mmio=False, rvc=False, logger=None, trace=False, regs=None, check_inv=False, start_checks=None, stop_checks=None, engine='auto', predecode=False, decode_cache_dir=None, intercept_libc=False, intercept_softfloat=False, idle_poll=True, wfi_fast_forward=True):
         self.cpu = cpu
         self.ram = ram
 
@@ -55,10 +66,27 @@ class Machine:
         self.regs = regs
         self.check_inv = check_inv
         self.start_checks = start_checks
+        self.stop_checks = stop_checks
         self.check_enable = False
+        # with tracing or register logging, only an explicit start condition delays them (see run())
+        self.start_checks_explicit = start_checks not in (None, 'auto')
+        self.start_checks_pc = None  # PC of the start condition (main, 0xADDR or symbol), see setup_checks()
+        self.stop_checks_pc = None   # PC at which checks stop and execution returns to the fast loops
+        self.start_checks_count = None  # instruction count of a +N start condition, see setup_checks()
+        self.engine = engine
+        self.predecode = predecode
+        self.decode_cache_dir = decode_cache_dir
+        self.intercept_libc = intercept_libc
+        self.intercept_softfloat = intercept_softfloat
+        self.idle_poll = idle_poll
+        cpu.wfi_fast_forward = bool(timer) and wfi_fast_forward  # (mtime only advances with the timer enabled)
+
+        if self.engine not in ('auto', 'interp', 'blocks', 'jit', 'native'):
+            raise SetupError(f"Unknown execution engine: '{self.engine}'")
 
         self.peripheral_list = []
         self.peripheral_runners = []
+        self.poll_detector = None  # busy-poll loop detection (see idle.py), set up by run() with MMIO
 
         if (self.trace or self.regs) and (self.logger is None):
             raise SetupError("Tracing or register logging require a valid logger")
@@ -73,9 +101,29 @@ class Machine:
         # text segment snapshot
         self.text_snapshot = None
 
+        # basic-block translation cache (set up on demand)
+        self.block_cache = None
+
+        # native accelerator core (set up on demand)
+        self.native_core = None
+
+        # predecoded text segment (set up at load time if requested)
+        self.predecoded = None
+
+        # stores into translated code and FENCE.I discard translations (see ram.py)
+        ram.code_written = self.invalidate_code
+        cpu.handle_fence_i = self.flush_code
+
+        # persistent decode cache file (set up at load time if a cache directory is given)
+        self.decode_cache_file = None
+
+        # host-native guest routines (see intercept.py): entry PC -> call (set up at load time if requested)
+        self.intercepts = {}
+
         # symbol dictionary for syscall tracing
         self.symbol_dict = {}
         self.main_addr = None
+        self.function_addrs = {}  # function name -> address (loaded if needed by intercepts or start/stop_checks)
 
     def register_peripheral(self, peripheral):
         self.peripheral_list.append(peripheral)
@@ -86,6 +134,8 @@ class Machine:
     def peripherals_run(self):
         for peripheral_runner in self.peripheral_runners:
             peripheral_runner()
+        if self.poll_detector is not None and self.poll_detector.detected:
+            self.poll_detector.park()  # guest busy-polling a peripheral register: wait on the host
 
     # setup argv[] strings in the heap
     def setup_argv(self, argv_list):
@@ -124,11 +174,17 @@ class Machine:
             elf = ELFFile(f)
 
             # load all segments
+            segments = []
             for segment in elf.iter_segments():
                 if segment['p_type'] == 'PT_LOAD':
                     addr = segment['p_paddr']
                     data = segment.data()
                     self.ram.store_binary(addr, data)
+                    segments.append((addr, data))
+
+            # if requested, reload the instructions decoded by previous runs of the same program
+            if self.decode_cache_dir is not None:
+                self.setup_decode_cache(segments)
 
             # set entry point
             self.cpu.pc = elf.header.e_entry
@@ -156,6 +212,16 @@ class Machine:
                             addr = sym['st_value']
                             self.symbol_dict[addr] = name
 
+                # function addresses by name, for interception and for checks starting/stopping at a symbol
+                if self.intercept_libc or self.intercept_softfloat or \
+                   any(self.is_symbol(when) for when in (self.start_checks, self.stop_checks)):
+                    self.function_addrs = { sym.name: sym['st_value'] for sym in symtab.iter_symbols()
+                                            if sym.name and sym['st_info']['type'] == 'STT_FUNC' }
+
+                # if requested, run well-known library routines as host-native code
+                if self.intercept_libc or self.intercept_softfloat:
+                    self.setup_intercepts(self.function_addrs)
+
             # get boundaries of the text segment
             text_section = elf.get_section_by_name(".text")
             if text_section:
@@ -164,28 +230,47 @@ class Machine:
                 # if checking for text segment integrity, take a snapshot
                 if check_text:
                     self.text_snapshot = self.ram.memory[self.text_start:self.text_end]
+                # if requested, decode the whole text segment ahead of time
+                if self.predecode:
+                    self.setup_predecode()
 
         if self.start_checks is None or self.start_checks == 'auto':
             self.start_checks = 'main'
         if self.start_checks == 'main' and self.main_addr is None and self.logger is not None:
             self.logger.warning("No symbol found for main() — invariants checks disabled")
     
+    # Returns True if a start/stop condition for checks names a function symbol
+    @staticmethod
+    def is_symbol(when):
+        if when is None or when in ('auto', 'early', 'main', 'first-call') or when.startswith('+'):
+            return False
+        try:
+            int(when, 0)
+            return False
+        except ValueError:
+            return True
+
+    # Resolve a start/stop condition for checks to a PC (main, 0xADDR or function symbol)
+    def resolve_checks_pc(self, when, option):
+        if when == 'main':
+            return self.main_addr
+        try:
+            return int(when, 0) & 0xFFFFFFFF
+        except ValueError:
+            if when not in self.function_addrs:
+                raise SetupError(f"Invalid {option} value (not an address or function symbol): {when}")
+            return self.function_addrs[when]
+
     # Invariant check trigger
     def trigger_check(self):
         if self.start_checks == 'early':
             return True
-        elif self.start_checks == 'main':
-            return self.cpu.pc == self.main_addr
         elif self.start_checks == 'first-call':
             inst = self.ram.load_word(self.cpu.pc)
             opcode = inst & 0x7F
             return opcode in (0x6F, 0x67)
         else:
-            try:
-                value = int(self.start_checks, 0) & 0xFFFFFFFF
-                return self.cpu.pc == value
-            except ValueError:
-                raise SetupError(f"Invalid --start-checks value: {self.start_checks}")
+            return self.cpu.pc == self.start_checks_pc
 
     # Invariants check
     def check_invariants(self):
@@ -262,48 +347,35 @@ class Machine:
 
         return lambda x: ', '.join( f"{name}=0x{getter(x):08X}" for name, getter in getters)  # register formatter
 
-    # EXECUTION LOOP: debug version (slow) with optional timer and MMIO
+    # Returns the generated per-instruction run loop (see loops.py) for the active features,
+    # with 16-bit dispatch as in the corresponding hand-written loops (checks=False: without checks, tracing or register logging)
+    def generated_loop(self, gdb=False, budget=False, until=False, checks=True):
+        from loops import generated_loop  # imported here to avoid circular dependency at module level
+        return generated_loop(compressed=(self.rvc or self.timer or self.mmio or gdb), timer=self.timer, mmio=self.mmio,
+                              regs=(checks and self.regs), trace=(checks and self.trace), check_inv=(checks and self.check_inv),
+                              gdb=gdb, stop=(checks and self.stop_checks_pc is not None and not gdb), budget=budget, until=until)
+
+    # EXECUTION LOOP: debug version (slow) with optional timer and MMIO, generated for the active checks
+    # Returns when execution reaches the stop_checks PC after checks have started (see run()).
     def run_with_checks(self):
-        cpu = self.cpu
-        ram = self.ram
-        timer = self.timer
-        mmio = self.mmio
-        div = 0
-        DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
+        self.generated_loop()(self)
 
-        if self.regs:
-            regformatter = self.make_regformatter_lambda(self.regs)
+    # EXECUTION LOOP: bounded run of a generated loop with the 'budget' feature (see loops.py)
+    # Runs at most limit instructions (None: no limit), until execution reaches until_pc, or until the watched
+    # word changes, which is compared between chunks of instructions. Returns the number of executed instructions.
+    def run_until(self, loop, limit=None, until_pc=None, watch=None):
+        executed = 0
+        CHUNK = 0x1000  # compare the watched word every 4K instructions (a multiple of the peripheral update period)
 
         while True:
-            if self.regs:
-                self.logger.debug(f"REGS: " + regformatter(cpu))
-            if self.check_inv:
-                self.check_invariants()
-            if self.trace and (cpu.pc in self.symbol_dict):
-                self.logger.debug(f"FUNC {self.symbol_dict[cpu.pc]}, PC={cpu.pc:08X}")
-
-            # Fetch 16 bits first to determine instruction length (RISC-V spec compliant)
-            # Note: PC alignment is checked in control flow instructions (JAL, JALR, branches, MRET)
-            inst_low = ram.load_half(cpu.pc, signed=False)
-            if (inst_low & 0x3) == 0x3:
-                # 32-bit instruction: fetch upper 16 bits
-                inst_high = ram.load_half(cpu.pc + 2, signed=False)
-                inst = inst_low | (inst_high << 16)
-            else:
-                # 16-bit compressed instruction
-                inst = inst_low
+            budget = CHUNK if limit is None else min(CHUNK, limit - executed)
+            executed += budget - loop(self, None, budget, until_pc)
+            if executed == limit or self.run_stopped(until_pc, watch):
+                return executed
 
-            cpu.execute(inst)
-            if timer:
-                cpu.timer_update()
-            cpu.pc = cpu.next_pc
-
-            # slow path for peripheral operation
-            if mmio:
-                div += 1
-                if div & DIV_MASK == 0:
-                    self.peripherals_run()
-                    div = 0
+    # Returns True if a bounded run (see run()) is at until_pc or the watched word has changed
+    def run_stopped(self, until_pc, watch):
+        return (until_pc is not None and self.cpu.pc == until_pc) or (watch is not None and self.ram.load_word(watch[0]) != watch[1])
 
     # EXECUTION LOOP: minimal version for RV32I only (fastest, no compressed instructions)
     def run_fast_no_rvc(self):
@@ -331,12 +403,222 @@ class Machine:
 
             cpu.pc = cpu.next_pc
 
+    # EXECUTION LOOP: basic-block translation cache (fastest, optional RVC)
+    # Executes a whole block per PC lookup. Block bodies never trap or branch,
+    # so only the terminating instruction goes through the regular execute path.
+    def run_blocks(self):
+        cpu = self.cpu
+        blocks = self.block_cache.blocks
+        translate = self.block_cache.translate
+        back_edge = self.block_cache.back_edge
+        traces = self.block_cache.compiler is not None  # count back-edges for trace formation
+
+        while True:
+            try:
+                body, term_pc, term = blocks[cpu.pc]
+            except KeyError:
+                body, term_pc, term = translate(cpu.pc)
+
+            try:
+                for pc, op in body:
+                    cpu.pc = pc
+                    op()
+            except CodeModified:  # the store at cpu.pc modified translated code: resume at the next instruction
+                cpu.pc = cpu.next_pc
+                continue
+
+            cpu.pc = term_pc
+            term()
+            if traces and cpu.next_pc <= term_pc:
+                back_edge(cpu.next_pc)
+            cpu.pc = cpu.next_pc
+
+    # EXECUTION LOOP: native accelerator (see rvnative.c), with optional timer and MMIO
+    # The native core runs chunks of instructions and stops before any instruction it does not implement
+    # (SYSTEM, MISC-MEM, AMOs, traps, MMIO accesses), which is then executed by the Python CPU.
+    # Chunks are sized so that timer and peripheral updates happen at the same instructions as in
+    # run_timer() and run_mmio(): mtime can only trigger an interrupt after the native chunk.
+    # Bounded runs (see run()) size the chunks to the remaining instruction budget, stop the native core
+    # at until_pc, and compare the watched word after each chunk. They return the number of executed instructions.
+    def run_native(self, limit=None, until_pc=None, watch=None):
+        cpu = self.cpu
+        ram = self.ram
+        timer = self.timer
+        mmio = self.mmio
+        compressed = self.rvc or timer or mmio  # 16-bit dispatch, as in the corresponding Python loops
+        run = self.native_core.run
+        intercepts = self.intercepts
+        bounded = limit is not None or until_pc is not None or watch is not None
+        executed = 0
+        div = 0
+        DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
+        CHUNK = 0x10000  # return to Python at least every 64K instructions (e.g., for KeyboardInterrupt)
+
+        if until_pc is not None:
+            self.native_core.set_stops(list(self.intercepts) + [until_pc])
+        try:
+            while True:
+                budget = CHUNK
+                if timer:
+                    budget = cpu.timer_countdown(budget)  # stop before the next timer event
+                if mmio:
+                    budget = min(budget, DIV_MASK - div)
+                if limit is not None:
+                    budget = min(budget, limit - executed - 1)  # (followed by one instruction below)
+
+                n = run(budget)
+                if timer:
+                    cpu.mtime += n
+                if bounded:
+                    executed += n
+                    if n and cpu.pc == until_pc:
+                        return executed
+
+                # one instruction through the Python CPU (or an intercepted routine, see intercept.py)
+                if not (cpu.pc in intercepts and intercepts[cpu.pc]()):
+                    inst = ram.load_word(cpu.pc)
+                    if compressed and (inst & 0x3) != 0x3:
+                        cpu.execute_16(inst & 0xFFFF)
+                    else:
+                        cpu.execute_32(inst)
+
+                if timer:
+                    cpu.timer_update()
+                cpu.pc = cpu.next_pc
+
+                # slow path for peripheral operation
+                if mmio:
+                    div += n + 1
+                    if div > DIV_MASK:
+                        self.peripherals_run()
+                        div = 0
+
+                if bounded:
+                    executed += 1
+                    if executed == limit or cpu.pc == until_pc or (watch is not None and ram.load_word(watch[0]) != watch[1]):
+                        return executed
+        finally:
+            if until_pc is not None:
+                self.native_core.set_stops(list(self.intercepts))
+
+    # EXECUTION LOOP: interpreter over the predecoded text segment (see predecode.py), with optional timer and MMIO
+    # Instructions within the text segment are taken from the predecoded slots, indexed by PC,
+    # all other instructions are fetched and executed as in run_timer() and run_mmio(),
+    # in the same chunks up to the next timer event or peripheral update.
+    def run_predecoded(self):
+        from cpu import exec_SYSTEM  # imported here to avoid circular dependency at module level
+        from ram import MMIOAccessDeferred  # imported here to avoid circular dependency at module level
+        cpu = self.cpu
+        ram = self.ram
+        timer = self.timer
+        mmio = self.mmio
+        compressed = self.predecoded.compressed
+        slots = self.predecoded.slots
+        fill = self.predecoded.fill
+        text_start = self.predecoded.start
+        text_end = self.predecoded.end
+        shift = self.predecoded.shift
+        registers = cpu.registers
+        div = 0
+        DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
+        CHUNK = 0x10000  # chunk size without timer and MMIO
+
+        while True:
+            # fast path: a chunk of instructions up to the next timer event or peripheral update
+            budget = DIV_MASK - div if mmio else CHUNK
+            if timer:
+                budget = cpu.timer_countdown(budget)
+            n = 0
+            if mmio:
+                ram.defer_mmio = timer
+            try:
+                while n < budget:
+                    pc = cpu.pc
+                    if text_start <= pc < text_end:
+                        handler, rd, rs1, rs2, imm, next_pc = slots[(pc - text_start) >> shift] or fill(pc)
+                        if handler is exec_SYSTEM:
+                            break  # SYSTEM
+                        cpu.next_pc = next_pc
+                        handler(cpu, rd, rs1, rs2, imm)
+                        registers[0] = 0
+                    else:
+                        inst = ram.load_word(pc)
+                        if compressed and (inst & 0x3) != 0x3:
+                            if inst & 0xFFFF == 0x9002:
+                                break  # C.EBREAK
+                            cpu.execute_16(inst & 0xFFFF)
+                        else:
+                            if (inst & 0x7F) == 0x73:
+                                break  # SYSTEM
+                            cpu.execute_32(inst)
+                    cpu.pc = cpu.next_pc
+                    n += 1
+            except MMIOAccessDeferred:
+                pass  # (executed again below)
+            finally:
+                if mmio:
+                    ram.defer_mmio = False
+                if timer:
+                    cpu.mtime += n
+
+            # slow path: one instruction followed by the timer update
+            pc = cpu.pc
+            if text_start <= pc < text_end:
+                handler, rd, rs1, rs2, imm, next_pc = slots[(pc - text_start) >> shift] or fill(pc)
+                cpu.next_pc = next_pc
+                handler(cpu, rd, rs1, rs2, imm)
+                registers[0] = 0
+            else:
+                inst = ram.load_word(pc)
+                if compressed and (inst & 0x3) != 0x3:
+                    cpu.execute_16(inst & 0xFFFF)
+                else:
+                    cpu.execute_32(inst)
+
+            if timer:
+                cpu.timer_update()
+            cpu.pc = cpu.next_pc
+
+            # slow path for peripheral operation
+            if mmio:
+                div += n + 1
+                if div > DIV_MASK:
+                    self.peripherals_run()
+                    div = 0
+
     # EXECUTION LOOP: minimal version + timer (mtime/mtimecmp)
+    # Rather than calling timer_update() after each instruction, instructions run in chunks up to the
+    # next timer event (see CPU.timer_countdown) and their count is added to mtime at the end of the chunk.
+    # The chunk ends early at SYSTEM instructions (timer CSRs, interrupt enables, MRET, WFI), which are
+    # executed with mtime up to date and followed by timer_update(), as is the last instruction of the chunk.
     def run_timer(self):
         cpu = self.cpu
         ram = self.ram
+        CHUNK = 0x10000  # return to the outer loop at least every 64K instructions
 
         while True:
+            # fast path: a chunk of instructions up to the next timer event
+            budget = cpu.timer_countdown(CHUNK)
+            n = 0
+            try:
+                while n < budget:
+                    inst = ram.load_word(cpu.pc)
+
+                    if (inst & 0x3) == 0x3:
+                        if (inst & 0x7F) == 0x73:
+                            break  # SYSTEM
+                        cpu.execute_32(inst)
+                    else:
+                        if inst & 0xFFFF == 0x9002:
+                            break  # C.EBREAK
+                        cpu.execute_16(inst & 0xFFFF)
+
+                    cpu.pc = cpu.next_pc
+                    n += 1
+            finally:
+                cpu.mtime += n  # (also when leaving the loop with an exception, e.g. on exit)
+
+            # slow path: one instruction followed by the timer update
             inst = ram.load_word(cpu.pc)
 
             if (inst & 0x3) == 0x3:
@@ -348,7 +630,11 @@ class Machine:
             cpu.pc = cpu.next_pc
 
     # EXECUTION LOOP: minimal version + MMIO + optional timer
+    # Chunks of instructions as in run_timer(), also ending at the next peripheral update. With the timer,
+    # MMIO accesses (which may read or write mtime/mtimecmp, see MMIOTimer) also end the chunk: the RAM
+    # raises MMIOAccessDeferred before the access, and the instruction is executed again with mtime up to date.
     def run_mmio(self):
+        from ram import MMIOAccessDeferred  # imported here to avoid circular dependency at module level
         cpu = self.cpu
         ram = self.ram
         timer = self.timer
@@ -356,6 +642,35 @@ class Machine:
         DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
 
         while True:
+            # fast path: a chunk of instructions up to the next timer event or peripheral update
+            budget = DIV_MASK - div
+            if timer:
+                budget = cpu.timer_countdown(budget)
+            n = 0
+            ram.defer_mmio = timer
+            try:
+                while n < budget:
+                    inst = ram.load_word(cpu.pc)
+
+                    if (inst & 0x3) == 0x3:
+                        if (inst & 0x7F) == 0x73:
+                            break  # SYSTEM
+                        cpu.execute_32(inst)
+                    else:
+                        if inst & 0xFFFF == 0x9002:
+                            break  # C.EBREAK
+                        cpu.execute_16(inst & 0xFFFF)
+
+                    cpu.pc = cpu.next_pc
+                    n += 1
+            except MMIOAccessDeferred:
+                pass  # (executed again below)
+            finally:
+                ram.defer_mmio = False
+                if timer:
+                    cpu.mtime += n
+
+            # slow path: one instruction followed by the timer update
             inst = ram.load_word(cpu.pc)
 
             if (inst & 0x3) == 0x3:
@@ -368,23 +683,216 @@ class Machine:
             cpu.pc = cpu.next_pc
 
             # slow path for peripheral operation
-            div += 1
-            if div & DIV_MASK == 0:
+            div += n + 1
+            if div > DIV_MASK:
                 self.peripherals_run()
                 div = 0
 
+    # Set up the basic-block translation cache (see blocks.py),
+    # with the hot-block compiler (see jit.py) unless the 'blocks' engine is explicitly requested
+    def setup_block_cache(self):
+        if self.cpu.block_cache is None:
+            from blocks import BlockCache  # imported here to avoid circular dependency at module level
+            self.cpu.block_cache = BlockCache(self.cpu, self.ram, jit=(self.engine in ('auto', 'jit')), intercepts=self.intercepts)
+        self.block_cache = self.cpu.block_cache
+
+    # Set up the persistent decode cache (see decodecache.py) and load it into the CPU decode caches
+    def setup_decode_cache(self, segments):
+        from decodecache import DecodeCacheFile, cache_key  # imported here to avoid circular dependency at module level
+        key = cache_key(segments, self.rvc, self.cpu.isa)
+        self.decode_cache_file = DecodeCacheFile(self.cpu, self.decode_cache_dir, key)
+        self.decode_cache_file.load()
+
+    # Save the CPU decode caches to the persistent decode cache, if set up (called at exit)
+    def save_decode_cache(self):
+        if self.decode_cache_file is not None:
+            try:
+                self.decode_cache_file.save()
+            except OSError as e:
+                if self.logger is not None:
+                    self.logger.warning(f"Could not save decode cache {self.decode_cache_file.path}: {e}")
+
+    # Set up host-native implementations of the guest library routines found in functions ({name: address})
+    def setup_intercepts(self, functions):
+        groups = [cls for cls, enabled in ((LibcIntercepts, self.intercept_libc), (SoftFloatIntercepts, self.intercept_softfloat)) if enabled]
+        for cls in groups:
+            group = cls(self.cpu, self.ram, self.ram.check_code)
+            self.intercepts.update(group.entries(functions))
+            if self.logger is not None:
+                names = ', '.join(name for name in group.routines() if name in functions)
+                self.logger.info(f"Intercepting {group.DESCRIPTION}: {names or 'none found'}")
+
+    # Discard any translated or predecoded code overlapping guest memory range [addr, addr+size),
+    # after the range was written to (called by the RAM for stores into pages holding translated code, see ram.py)
+    def invalidate_code(self, addr, size):
+        if self.cpu.block_cache is not None:
+            self.cpu.block_cache.invalidate(addr, size)
+        if self.predecoded is not None:
+            self.predecoded.invalidate(addr, size)
+        if self.native_core is not None:
+            self.native_core.invalidate(addr, size)
+
+    # Discard all translated and predecoded code (FENCE.I)
+    def flush_code(self):
+        if self.cpu.block_cache is not None:
+            self.cpu.block_cache.flush()
+        if self.native_core is not None:
+            self.native_core.flush()
+        self.ram.clear_code()
+        if self.predecoded is not None:
+            self.predecoded.flush()  # (slots are refilled on demand, the text segment stays marked)
+            self.ram.mark_code(self.predecoded.start, self.predecoded.end - self.predecoded.start)
+
+    # Set up the predecoded text segment (see predecode.py), used by run_predecoded()
+    def setup_predecode(self):
+        from predecode import PredecodedText  # imported here to avoid circular dependency at module level
+        compressed = self.rvc or self.timer or self.mmio  # 16-bit dispatch, as in the other interpreter loops
+        self.predecoded = PredecodedText(self.cpu, self.ram, self.text_start, self.text_end, compressed, self.intercepts)
+        self.ram.mark_code(self.text_start, self.text_end - self.text_start)
+
+    # Set up busy-poll loop detection on the MMIO peripheral registers (see idle.py)
+    def setup_idle_poll(self):
+        self.poll_detector = PollDetector(self.cpu, self.ram, self.peripheral_list, self.timer)
+
+    # Set up the native accelerator core (see rvnative.c), returns False if the extension is not built
+    def setup_native(self):
+        if self.native_core is not None:
+            return True
+        try:
+            import rvnative
+        except ImportError:
+            if self.engine == 'native':
+                raise SetupError("Native accelerator not available (build it with 'make native')")
+            return False
+        compressed = self.rvc or self.timer or self.mmio
+        self.native_core = rvnative.Core(self.cpu, self.ram, compressed, expand_compressed_table)
+        if self.intercepts:
+            self.native_core.set_stops(list(self.intercepts))  # intercepted routines are called from run_native()
+        return True
+
     # Run the emulator loop.
     # For performance reasons, we use different implementations of the emulator loop,
     # selected according to the requested features, rather than having a single implementation
     # with several conditions along the hot execution path.
-    def run(self):
+    # With checks, tracing or register logging, execution starts in the fastest loop whenever the
+    # start condition is a PC (main, 0xADDR or a function symbol, in the .text segment): the PC is
+    # intercepted like a guest routine (see intercept.py), and execution is handed off to run_with_checks()
+    # from there on, and back to the fastest loop at the stop_checks PC, if any (until the start PC is reached again).
+    # Tracing and register logging start from the beginning, unless a start condition is given explicitly.
+    # An instruction-count start condition (+N) runs the first N instructions in the fastest loop.
+    #
+    # Bounded runs return after max_instructions instructions, when execution reaches until_pc (after at least
+    # one instruction), or when the word at address until_store changes, whichever comes first, and return the
+    # number of executed instructions. They run in the native core if available, otherwise in the generated
+    # loop (see loops.py), with an instruction countdown and the stores compared every chunk of instructions.
+    # Unbounded runs never return: they end by raising (see below), so run() returns an instruction count
+    # whenever it returns.
+    def run(self, max_instructions=None, until_pc=None, until_store=None):
         # Verify initial PC alignment based on RVC support
         alignment_mask = 0x1 if self.rvc else 0x3
         if self.cpu.pc & alignment_mask:
             raise MachineError(f"Initial PC=0x{self.cpu.pc:08X} violates {2 if self.rvc else 4}-byte alignment requirement")
 
-        if self.regs or self.check_inv or self.trace:
-            self.run_with_checks()  # checks everything at every cycle, up to 3x slower (always with RVC support)
+        checks = self.regs or self.check_inv or self.trace
+        if self.mmio and self.idle_poll and not checks and self.poll_detector is None:
+            self.setup_idle_poll()  # (not with checks and tracing, which must see every instruction)
+
+        if max_instructions is not None or until_pc is not None or until_store is not None:
+            if self.poll_detector is not None:
+                self.poll_detector.enabled = False  # (parking would step and skip uncounted instructions, see idle.py)
+            try:
+                return self.run_bounded(max_instructions, until_pc, until_store, checks)
+            finally:
+                if self.poll_detector is not None:
+                    self.poll_detector.enabled = True
+
+        # unbounded runs: the run loops only leave by raising (ExecutionTerminated at guest exit, errors,
+        # KeyboardInterrupt), the instructions executed along the way are not counted
+        if not checks:
+            self.run_fastest()
+            raise MachineError("Unbounded run loop returned")
+
+        self.setup_checks()
+        if self.start_checks_count is not None:
+            self.run_fastest(self.start_checks_count)  # fast-forward, then checks at every cycle
+            self.enter_counted_checks()
+            self.run_with_checks()
+            self.run_fastest()  # (past the stop_checks PC)
+            raise MachineError("Unbounded run loop returned")
+
+        trigger = self.start_checks_pc
+        if trigger is None or self.text_start is None or not (self.text_start <= trigger < self.text_end) or \
+           ((self.regs or self.trace) and not self.start_checks_explicit):
+            # checks everything at every cycle from the start, up to 3x slower (always with RVC support)
+            self.check_enable = self.check_enable or not self.check_inv  # (tracing and register logging are on)
+            self.run_with_checks()
+            self.run_fastest()  # (past the stop_checks PC)
+            raise MachineError("Unbounded run loop returned")
+
+        self.intercepts[trigger] = self.enter_checks
+        self.invalidate_code(trigger, 2)  # (predecoded at load time)
+        while True:
+            try:
+                self.run_fastest()
+            except ChecksTriggered:
+                self.check_enable = True
+                if self.logger is not None:
+                    self.logger.debug(f"Checking started ({self.start_checks}) at PC=0x{self.cpu.pc:08X}")
+            self.run_with_checks()
+
+    # Bounded run (see run()), returns the number of executed instructions
+    def run_bounded(self, max_instructions, until_pc, until_store, checks):
+        watch = None if until_store is None else (until_store, self.ram.load_word(until_store))
+        if max_instructions is not None and max_instructions <= 0:
+            return 0
+        if not checks:
+            return self.run_fastest(max_instructions, until_pc, watch)
+        self.setup_checks()
+        executed = 0
+        if self.start_checks_count is not None and not self.check_enable:
+            count = self.start_checks_count
+            executed = self.run_fastest(count if max_instructions is None else min(count, max_instructions), until_pc, watch)
+            if executed < count or executed == max_instructions or self.run_stopped(until_pc, watch):
+                return executed
+            self.enter_counted_checks()
+        self.check_enable = self.check_enable or not self.check_inv  # (tracing and register logging are on)
+        limit = None if max_instructions is None else max_instructions - executed
+        return executed + self.run_until(self.generated_loop(budget=True, until=(until_pc is not None)), limit, until_pc, watch)
+
+    # Resolve the start/stop conditions of checks to PCs
+    def setup_checks(self):
+        if self.start_checks is not None and self.start_checks.startswith('+'):
+            try:
+                self.start_checks_count = int(self.start_checks[1:], 0)
+            except ValueError:
+                raise SetupError(f"Invalid --start-checks instruction count: {self.start_checks}")
+        elif self.start_checks not in ('early', 'first-call'):
+            self.start_checks_pc = self.resolve_checks_pc(self.start_checks, '--start-checks')
+        if self.stop_checks is not None:
+            self.stop_checks_pc = self.resolve_checks_pc(self.stop_checks, '--stop-checks')
+
+    # Intercepted start_checks PC (see run()): leaves the fast loop before executing the instruction there
+    def enter_checks(self):
+        raise ChecksTriggered(f"Checks triggered at PC=0x{self.cpu.pc:08X}")
+
+    # Instruction-count start condition (+N) reached in the fastest loop (see run())
+    def enter_counted_checks(self):
+        self.check_enable = True
+        if self.logger is not None:
+            self.logger.debug(f"Checking started ({self.start_checks}) at PC=0x{self.cpu.pc:08X}")
+
+    # Run the fastest emulator loop for the requested features (no checks, tracing or register logging)
+    # Bounded runs (see run()) return the number of executed instructions.
+    def run_fastest(self, limit=None, until_pc=None, watch=None):
+        if self.engine in ('auto', 'native') and self.setup_native():
+            return self.run_native(limit, until_pc, watch)  # Native accelerator, optional timer and MMIO (if built, see rvnative.c)
+        elif limit is not None or until_pc is not None or watch is not None:
+            # Instruction countdown in the generated loop, optional timer and MMIO
+            return self.run_until(self.generated_loop(budget=True, until=(until_pc is not None), checks=False), limit, until_pc, watch)
+        elif (self.predecoded is not None or self.intercepts) and (self.engine == 'interp' or self.timer or self.mmio):
+            if self.predecoded is None:
+                self.setup_predecode()  # (intercepted routines are only recognized by PC-indexed run loops)
+            self.run_predecoded()  # Interpreter over the predecoded text segment, optional timer and MMIO
         else:
             if self.mmio:
                 self.run_mmio()  # MMIO support, optional timer (always with RVC support)
@@ -394,7 +902,10 @@ class Machine:
                 else:
                     # Fastest option, no timer, no checks, no MMIO
                     # RVC support is optional for maximum performance on pure RV32I code
-                    if self.rvc:
+                    if self.engine in ('auto', 'blocks', 'jit'):
+                        self.setup_block_cache()
+                        self.run_blocks()  # Basic-block translation cache (with or without RVC)
+                    elif self.rvc:
                         self.run_fast()  # Fast with RVC support (half-word fetches)
                     else:
                         self.run_fast_no_rvc()  # Fastest: pure RV32I (32-bit word fetches)
@@ -417,9 +928,6 @@ class Machine:
         ram = self.ram
         timer = self.timer
         mmio = self.mmio
-        div = 0
-        DIV_MASK = 0xFF  # call peripheral run() methods every 256 cycles
-        INTERRUPT_CHECK_MASK = 0xFFF  # check for interrupts every 4096 cycles (~2ms)
 
         # Single step mode - execute one instruction then break
         if gdb_stub.single_step:
@@ -445,43 +953,11 @@ class Machine:
             raise DebugBreak("Single step complete", signal=5)  # SIGTRAP
 
         # Continue mode - run until breakpoint or exception
-        cycle_count = 0
-        while gdb_stub.running:
-            # Check for breakpoint BEFORE executing instruction
-            if gdb_stub.is_breakpoint(cpu.pc):
-                raise DebugBreak(f"Breakpoint at 0x{cpu.pc:08x}", signal=5)  # SIGTRAP
-
-            # Periodically check for interrupt from GDB (Ctrl+C)
-            # Note: This only works while executing instructions. If the program
-            # is blocked in a syscall (e.g., READ waiting for input), the interrupt
-            # won't be detected until the syscall completes.
-            cycle_count += 1
-            if cycle_count & INTERRUPT_CHECK_MASK == 0:
-                if gdb_stub.check_for_interrupt():
-                    gdb_stub.running = False
-                    raise DebugBreak("Interrupted by user", signal=2)  # SIGINT
-
-            # Fetch and execute instruction
-            inst_low = ram.load_half(cpu.pc, signed=False)
-            if (inst_low & 0x3) == 0x3:
-                # 32-bit instruction
-                inst_high = ram.load_half(cpu.pc + 2, signed=False)
-                inst = inst_low | (inst_high << 16)
-                cpu.execute_32(inst)
-            else:
-                # 16-bit compressed instruction
-                cpu.execute_16(inst_low)
-
-            if timer:
-                cpu.timer_update()
-            cpu.pc = cpu.next_pc
-
-            # Run peripherals periodically
-            if mmio:
-                div += 1
-                if div & DIV_MASK == 0:
-                    self.peripherals_run()
-                    div = 0
+        # (generated loop, also with the requested checks, tracing and register logging)
+        # Note: Ctrl+C from GDB is only detected while executing instructions. If the program
+        # is blocked in a syscall (e.g., READ waiting for input), the interrupt
+        # won't be detected until the syscall completes.
+        self.generated_loop(gdb=True)(self, gdb_stub)
 
     # EXECUTION LOOP: GDB stub command loop
     def run_gdbstub(self, gdb_stub):
@@ -497,6 +973,10 @@ class Machine:
         # Import here to avoid circular dependency at module level
         from gdbstub import GDBSignals
 
+        self.setup_checks()
+        if not self.check_inv:
+            self.check_enable = True  # (tracing and register logging are on from the start)
+
         if self.logger:
             self.logger.info("Waiting for GDB connection...")
 
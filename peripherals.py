@@ -29,6 +29,11 @@ class MMIOPeripheral:
     def write32(self, addr, value):
         pass
 
+    # file descriptors whose readability may change the values read from the registers
+    # (waited for by the emulator while the guest busy-polls a register, see idle.py)
+    def wait_fds(self):
+        return ()
+
     # a run() method, if defined, will be registered and called periodically by the emulator 
     #def run(self):
     #    pass
@@ -76,6 +81,7 @@ class MMIOTimer(MMIOPeripheral):
             self.mtime_hi_updated = True
         else:
             raise MemoryAccessError(f"Invalid MMIO register write at 0x{addr:08X}")
+        self.cpu.interrupt_check = True  # (MTIP is evaluated again after this instruction)
 
        # atomic update of mtime after writing both high and low words
         if self.mtime_lo_updated and self.mtime_hi_updated:
@@ -121,6 +127,9 @@ class PtyUART(MMIOPeripheral):
             except BlockingIOError:
                 pass
 
+    def wait_fds(self):
+        return (self.master_fd,)
+
     # Memory-mapped interface
     
     def read32(self, addr):
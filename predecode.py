@@ -0,0 +1,111 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+from machine import MachineError
+from cpu import exec_illegal
+
+# Ahead-of-time predecoded text segment.
+#
+# The text segment is decoded once, at load time, into a flat list with one slot per halfword
+# (one per word when compressed instructions are not dispatched), so that the per-instruction
+# run loop (Machine.run_predecoded) finds the decoded instruction at PC by indexing the list with
+# (pc - start) >> shift, instead of going through the decode cache dictionaries of the CPU.
+# Each slot holds a (handler, rd, rs1, rs2, imm, next_pc) tuple, where the first five items are
+# the leaf handler and operands returned by decode_leaf(), and next_pc is the address of the
+# following instruction. Empty slots (None) are decoded on demand by fill().
+#
+# The text segment is decoded by a linear sweep from its start, following instruction lengths:
+# halfwords in the middle of 32-bit instructions are only decoded if execution ever reaches them.
+#
+# The slots of the entry points of intercepted guest routines (see intercept.py) call their
+# host-native implementation, falling back to the decoded instruction.
+#
+# Slots must be invalidated when code is modified. The text segment is marked in the RAM page
+# bitmap (see ram.py): any store into it (including AMOs and DMA) invalidates the slots it overwrites
+# through Machine.invalidate_code, and FENCE.I empties all slots (as required by the RISC-V spec for
+# self-modifying code).
+
+# Entry point of an intercepted routine: host-native call, or the original slot entry if it falls back
+def exec_intercept(cpu, call, entry, rs2, imm):
+    if not call():
+        handler, rd, rs1, rs2, imm, next_pc = entry
+        handler(cpu, rd, rs1, rs2, imm)
+
+class PredecodedText:
+    def __init__(self, cpu, ram, start, end, compressed, intercepts=None):
+        self.cpu = cpu
+        self.ram = ram
+        self.start = start
+        self.end = end
+        self.compressed = compressed
+        self.intercepts = intercepts if intercepts is not None else {}  # entry PC -> host-native routine (see intercept.py)
+        self.shift = 1 if compressed or (start & 0x3) else 2
+        self.slots = [None] * (((end - start) + (1 << self.shift) - 1) >> self.shift)
+
+        self.predecode()
+
+    # Decode the whole text segment (linear sweep)
+    def predecode(self):
+        pc = self.start
+        while pc < self.end:
+            try:
+                entry = self.decode(pc)
+            except MachineError:
+                return  # text segment extends past the end of RAM: leave the rest to fill()
+            self.slots[(pc - self.start) >> self.shift] = entry
+            pc = entry[5]
+
+    # Decode the instruction at pc into a slot entry (sharing the decode caches of the CPU)
+    def decode(self, pc):
+        cpu = self.cpu
+        inst = self.ram.load_word(pc)
+
+        if self.compressed and (inst & 0x3) != 0x3:
+            inst16 = inst & 0xFFFF
+            decoded = cpu.decode_cache_compressed.get(inst16)
+            if decoded is None:
+                decoded = cpu.decoder_compressed.lookup(inst16)
+                if decoded is None:  # same log message and trap as CPU.execute_16
+                    return (exec_illegal, inst16, f"Invalid compressed instruction at PC={{pc:08X}}: 0x{inst16:04X}", 0, 0, (pc + 2) & 0xFFFFFFFF)
+            inst_size = 2
+        else:
+            decoded = cpu.decode_cache.get(inst >> 2)
+            if decoded is None:
+                decoded = cpu.decoder.lookup(inst)
+            inst_size = 4
+
+        handler, rd, rs1, rs2, imm = decoded
+        entry = (handler, rd, rs1, rs2, imm, (pc + inst_size) & 0xFFFFFFFF)
+        if pc in self.intercepts:
+            return (exec_intercept, self.intercepts[pc], entry, 0, 0, entry[5])
+        return entry
+
+    # Decode the (empty) slot at pc, called by the run loop
+    def fill(self, pc):
+        entry = self.slots[(pc - self.start) >> self.shift] = self.decode(pc)
+        return entry
+
+    # Empty all slots (e.g., on FENCE.I)
+    def flush(self):
+        self.slots[:] = [None] * len(self.slots)  # (in place: the run loop holds a reference to the list)
+
+    # Empty the slots of the instructions overlapping guest memory range [addr, addr+size)
+    def invalidate(self, addr, size):
+        first = max((addr - 2 - self.start) >> self.shift, 0)  # a 32-bit instruction may start 2 bytes earlier
+        last = min((addr + size - 1 - self.start) >> self.shift, len(self.slots) - 1)
+        for index in range(first, last + 1):
+            self.slots[index] = None
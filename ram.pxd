@@ -0,0 +1,50 @@
+#
+# Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License,
+# or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+#
+
+# Cython declarations for the compiled build of ram.py ('make compiled', see compiled.py).
+# The RAM classes become extension types with typed storage, and the memory access methods become
+# cpdef methods, so that accesses from the compiled CPU are direct C calls. Attributes that are not
+# declared here live in the instance __dict__, just like in the pure-Python module.
+
+cdef class RAM:
+    cdef dict __dict__
+    cdef public bytearray memory
+    cdef unsigned int[:] memory32  # word view (typed, only used within ram.py)
+    cdef public object size
+    cdef public object logger
+    cdef public bytearray code_pages
+    cdef public object code_written
+
+    cpdef load_word(self, addr)
+    cpdef store_byte(self, addr, value)
+    cpdef store_half(self, addr, value)
+    cpdef store_word(self, addr, value)
+
+cdef class SafeRAM(RAM):
+    cpdef check(self, addr, n)
+
+cdef class SafeRAMOffset(RAM):
+    cpdef check(self, addr, n)
+
+cdef class RAM_MMIO(RAM):
+    cdef public list mmio_ranges
+    cdef public object defer_mmio
+
+cdef class SafeRAM_MMIO(RAM):
+    cdef public list mmio_ranges
+    cdef public object defer_mmio
+    cpdef check(self, addr, n)
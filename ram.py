@@ -28,10 +28,22 @@ import random
 # - RAM_MMIO:       RAM class with MMIO
 # - SafeRAM_MMIO:   Safe RAM class with MMIO, all accesses are checked
 #
+# All classes keep track of the RAM pages holding translated code (block cache, predecoded text, native core),
+# marked by the translators with mark_code(): stores into those pages, including store_binary() from loaders,
+# syscalls and DMA, call code_written(addr, size) (see Machine.invalidate_code), which discards the translations
+# they overwrite. Stores into other pages only pay for one bytearray lookup.
+#
+
+CODE_PAGE_SHIFT = 8  # granularity of the translated code bitmap (256 bytes, as the block cache page index)
 
 class MemoryAccessError(MachineError):
     pass
 
+# Raised by the MMIO classes on accesses to a peripheral while defer_mmio is set, before any side effect:
+# the run loops with timer execute the instruction again with mtime up to date (see Machine.run_mmio)
+class MMIOAccessDeferred(Exception):
+    pass
+
 def initialize_ram(ram, fill='0x00'):
     if fill == 'random':
         for i in range(ram.size):
@@ -54,6 +66,8 @@ class RAM:
         self.memory32 = memoryview(self.memory ).cast("I")  # word view
         self.size = size
         self.logger = logger
+        self.code_pages = bytearray(((size + padding) >> CODE_PAGE_SHIFT) + 1)  # RAM page -> 1 if it holds translated code
+        self.code_written = None  # code_written(addr, size): called on stores into pages holding translated code
         if init is not None and init != 'zero':
             initialize_ram(self, init)
 
@@ -85,6 +99,8 @@ class RAM:
             self.memory[addr] = value & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{1})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 1)
 
     def store_half(self, addr, value):
         try:
@@ -93,6 +109,8 @@ class RAM:
             self.memory[addr+1] = (value >> 8) & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{2})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 2)
 
     def store_word(self, addr, value):
         try:
@@ -106,6 +124,8 @@ class RAM:
                 self.memory[addr+3] = (value >> 24) & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{4})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 4)
 
     def load_binary(self, addr, n):
         return self.memory[addr:addr+n]
@@ -115,6 +135,7 @@ class RAM:
             self.memory[addr:addr+len(binary)] = binary
         except (IndexError, BufferError):
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X}-0x{addr+len(binary)}")
+        self.check_code(addr, len(binary))
 
     def load_cstring(self, addr, max_len=1024):
         end = min(addr + max_len, self.size)
@@ -124,6 +145,25 @@ class RAM:
             raise MemoryAccessError(f"Exceeded maximum length while reading C string at 0x{addr:08X}")
         return memory_slice[:nul_index].decode('utf-8', errors='replace')
 
+    # Mark guest memory range [addr, addr+size) as holding translated code
+    def mark_code(self, addr, size):
+        offset = addr - getattr(self, 'base_addr', 0)
+        if self.code_written is None or size <= 0 or offset + size <= 0 or offset >= self.size:
+            return  # (code outside RAM cannot be written)
+        last = min(offset + size - 1, self.size - 1)
+        offset = max(offset - 3, 0)  # (stores only check the page of their first byte)
+        self.code_pages[offset >> CODE_PAGE_SHIFT:(last >> CODE_PAGE_SHIFT) + 1] = b'\x01' * ((last >> CODE_PAGE_SHIFT) - (offset >> CODE_PAGE_SHIFT) + 1)
+
+    # Forget all translated code (after all translations have been discarded, e.g. on FENCE.I)
+    def clear_code(self):
+        self.code_pages[:] = bytes(len(self.code_pages))  # (in place: the native core holds a view of the bitmap)
+
+    # Write into guest memory range [addr, addr+size) other than through the store methods (e.g., bulk copies)
+    def check_code(self, addr, size):
+        offset = addr - getattr(self, 'base_addr', 0)
+        if size > 0 and offset >= 0 and self.code_pages.find(1, offset >> CODE_PAGE_SHIFT, ((offset + size - 1) >> CODE_PAGE_SHIFT) + 1) >= 0:
+            self.code_written(addr, size)
+
 # Safe RAM class: all accesses are checked, no MMIO
 class SafeRAM(RAM):
     def __init__(self, size=1024*1024, init=None, logger=None):
@@ -153,12 +193,16 @@ class SafeRAM(RAM):
     def store_byte(self, addr, value):
         self.check(addr, 1)
         self.memory[addr] = value & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 1)
 
     def store_half(self, addr, value):
         self.check(addr, 2)
         value &= 0xFFFF  # make it unsigned
         self.memory[addr] = value & 0xFF
         self.memory[addr+1] = (value >> 8) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 2)
 
     def store_word(self, addr, value):
         self.check(addr, 4)
@@ -170,6 +214,8 @@ class SafeRAM(RAM):
             self.memory[addr+1] = (value >> 8) & 0xFF
             self.memory[addr+2] = (value >> 16) & 0xFF
             self.memory[addr+3] = (value >> 24) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 4)
 
     def load_binary(self, addr, n):
         self.check(addr, n)
@@ -178,6 +224,7 @@ class SafeRAM(RAM):
     def store_binary(self, addr, binary):
         self.check(addr, n=len(binary))
         self.memory[addr:addr+len(binary)] = binary
+        self.check_code(addr, len(binary))
 
     def load_cstring(self, addr, max_len=1024):
         if addr < 0 or addr >= self.size:
@@ -223,6 +270,8 @@ class SafeRAMOffset(RAM):
         addr -= self.base_addr
         self.check(addr, 1)
         self.memory[addr] = value & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr + self.base_addr, 1)
 
     def store_half(self, addr, value):
         addr -= self.base_addr
@@ -230,6 +279,8 @@ class SafeRAMOffset(RAM):
         value &= 0xFFFF  # make it unsigned
         self.memory[addr] = value & 0xFF
         self.memory[addr+1] = (value >> 8) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr + self.base_addr, 2)
 
     def store_word(self, addr, value):
         addr -= self.base_addr
@@ -242,6 +293,8 @@ class SafeRAMOffset(RAM):
             self.memory[addr+1] = (value >> 8) & 0xFF
             self.memory[addr+2] = (value >> 16) & 0xFF
             self.memory[addr+3] = (value >> 24) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr + self.base_addr, 4)
 
     def load_binary(self, addr, n):
         addr -= self.base_addr
@@ -252,6 +305,7 @@ class SafeRAMOffset(RAM):
         addr -= self.base_addr
         self.check(addr, n=len(binary))
         self.memory[addr:addr+len(binary)] = binary
+        self.check_code(addr + self.base_addr, len(binary))
 
     def load_cstring(self, addr, max_len=1024):
         addr -= self.base_addr
@@ -269,6 +323,7 @@ class RAM_MMIO(RAM):
     def __init__(self, size=1024*1024, init=None, logger=None):
         super().__init__(size, init, logger)
         self.mmio_ranges = []
+        self.defer_mmio = False
 
     def register_peripheral(self, peripheral):
         self.mmio_ranges.append( (peripheral.REG_BASE, peripheral.REG_END, peripheral.read32, peripheral.write32) )
@@ -290,6 +345,8 @@ class RAM_MMIO(RAM):
     def load_word(self, addr):  # always unsigned (performance)
         for (mmio_addr_base, mmio_addr_end, mmio_read32, mmio_write32) in self.mmio_ranges:
             if mmio_addr_base <= addr < mmio_addr_end:
+                if self.defer_mmio:
+                    raise MMIOAccessDeferred
                 return mmio_read32(addr)
 
         try:
@@ -305,6 +362,8 @@ class RAM_MMIO(RAM):
             self.memory[addr] = value & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{1})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 1)
 
     def store_half(self, addr, value):
         try:
@@ -313,12 +372,16 @@ class RAM_MMIO(RAM):
             self.memory[addr+1] = (value >> 8) & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{2})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 2)
 
     def store_word(self, addr, value):
         value &= 0xFFFFFFFF  # make it unsigned
 
         for (mmio_addr_base, mmio_addr_end, mmio_read32, mmio_write32) in self.mmio_ranges:
             if mmio_addr_base <= addr < mmio_addr_end:
+                if self.defer_mmio:
+                    raise MMIOAccessDeferred
                 mmio_write32(addr, value)
                 return
 
@@ -332,6 +395,8 @@ class RAM_MMIO(RAM):
                 self.memory[addr+3] = (value >> 24) & 0xFF
         except IndexError:
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X} (+{4})")
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 4)
 
     def load_binary(self, addr, n):
         return self.memory[addr:addr+n]
@@ -341,6 +406,7 @@ class RAM_MMIO(RAM):
             self.memory[addr:addr+len(binary)] = binary
         except (IndexError, BufferError):
             raise MemoryAccessError(f"Access out of bounds: 0x{addr:08X}-0x{addr+len(binary)}")
+        self.check_code(addr, len(binary))
 
     def load_cstring(self, addr, max_len=1024):
         end = min(addr + max_len, self.size)
@@ -355,6 +421,7 @@ class SafeRAM_MMIO(RAM):
     def __init__(self, size=1024*1024, init=None, logger=None):
         super().__init__(size, init, logger)
         self.mmio_ranges = []
+        self.defer_mmio = False
 
     def register_peripheral(self, peripheral):
         self.mmio_ranges.append( (peripheral.REG_BASE, peripheral.REG_END, peripheral.read32, peripheral.write32) )
@@ -376,6 +443,8 @@ class SafeRAM_MMIO(RAM):
     def load_word(self, addr):  # always unsigned (performance)
         for (mmio_addr_base, mmio_addr_end, mmio_read32, mmio_write32) in self.mmio_ranges:
             if mmio_addr_base <= addr < mmio_addr_end:
+                if self.defer_mmio:
+                    raise MMIOAccessDeferred
                 return mmio_read32(addr)
 
         self.check(addr, 4)
@@ -387,18 +456,24 @@ class SafeRAM_MMIO(RAM):
     def store_byte(self, addr, value):
         self.check(addr, 1)
         self.memory[addr] = value & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 1)
 
     def store_half(self, addr, value):
         self.check(addr, 2)
         value &= 0xFFFF  # make it unsigned
         self.memory[addr] = value & 0xFF
         self.memory[addr+1] = (value >> 8) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 2)
 
     def store_word(self, addr, value):
         value &= 0xFFFFFFFF  # make it unsigned
 
         for (mmio_addr_base, mmio_addr_end, mmio_read32, mmio_write32) in self.mmio_ranges:
             if mmio_addr_base <= addr < mmio_addr_end:
+                if self.defer_mmio:
+                    raise MMIOAccessDeferred
                 mmio_write32(addr, value)
                 return
 
@@ -410,6 +485,8 @@ class SafeRAM_MMIO(RAM):
             self.memory[addr+1] = (value >> 8) & 0xFF
             self.memory[addr+2] = (value >> 16) & 0xFF
             self.memory[addr+3] = (value >> 24) & 0xFF
+        if self.code_pages[addr >> CODE_PAGE_SHIFT]:
+            self.code_written(addr, 4)
 
     def load_binary(self, addr, n):
         self.check(addr, n)
@@ -418,6 +495,7 @@ class SafeRAM_MMIO(RAM):
     def store_binary(self, addr, binary):
         self.check(addr, n=len(binary))
         self.memory[addr:addr+len(binary)] = binary
+        self.check_code(addr, len(binary))
 
     def load_cstring(self, addr, max_len=1024):
         if addr < 0 or addr >= self.size:
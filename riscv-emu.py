@@ -20,8 +20,11 @@ import sys, os, argparse
 import tty, termios
 import logging, time
 
+from compiled import use_compiled_modules
+use_compiled_modules()  # prefer the Cython-compiled core modules, if built (see compiled.py)
+
 from machine import Machine, MachineError, SetupError, ExecutionTerminated
-from cpu import CPU
+from cpu import CPU, set_decode_cache_limit
 from ram import RAM, SafeRAM, RAM_MMIO, SafeRAM_MMIO
 from syscalls import SyscallHandler
 from peripherals import PtyUART, MMIOTimer, MMIOBlockDevice
@@ -57,11 +60,21 @@ def parse_args():
     parser.add_argument("--check-ram", action="store_true", help="Check memory accesses")
     parser.add_argument("--check-text", action="store_true", help="Ensure text segment is not modified")
     parser.add_argument("--check-all", action="store_true", help="Enable all checks")
-    parser.add_argument("--start-checks", metavar="WHEN", default="auto", help="Condition to enable checks (auto, early, main, first-call, 0xADDR)")
+    parser.add_argument("--start-checks", metavar="WHEN", default="auto", help="Condition to enable checks (auto, early, main, first-call, 0xADDR, SYMBOL, +N instructions)")
+    parser.add_argument("--stop-checks", metavar="WHERE", default=None, help="PC at which checks stop until the start condition is met again (0xADDR, SYMBOL)")
     parser.add_argument("--init-regs", metavar="VALUE", default="zero", help='Initial register state (zero, random, 0xDEADBEEF)')
     parser.add_argument('--init-ram', metavar='PATTERN', default='zero', help='Initialize RAM with pattern (zero, random, addr, 0xAA)')
     parser.add_argument('--ram-size', metavar="KBS", type=int, default=1024, help='Emulated RAM size (kB, default 1024)')
     parser.add_argument('--rvc', action="store_true", help='Enable RVC (compressed instructions) support')
+    parser.add_argument('--max-insns', metavar='N', type=lambda x: int(x, 0), default=None, help='Stop after executing N instructions')
+    parser.add_argument('--engine', choices=['auto', 'native', 'jit', 'blocks', 'interp'], default='auto', help='Execution engine (default: auto)')
+    parser.add_argument('--predecode', action='store_true', help='Predecode the ELF text segment at load time (interpreter loops)')
+    parser.add_argument('--decode-cache', metavar='DIR', help='Persistent decode cache directory (reused across runs of the same ELF)')
+    parser.add_argument('--decode-cache-limit', metavar='N', type=int, default=None, help='Bound the in-memory decode cache to N instructions (default: unbounded; misses, not hits, are counted)')
+    parser.add_argument('--intercept-libc', action='store_true', help='Run libc memory/string routines (memcpy, strlen, ...) as host code (ELF symbols)')
+    parser.add_argument('--intercept-softfloat', action='store_true', help='Run libgcc soft-float routines (__adddf3, ...) as host IEEE-754 code (ELF symbols)')
+    parser.add_argument('--no-idle-poll', dest='idle_poll', action='store_false', help='Do not detect guest busy-poll loops on MMIO registers (spin instead of waiting on the host)')
+    parser.add_argument('--no-wfi-fast-forward', dest='wfi_fast_forward', action='store_false', help='Execute WFI as a no-op instead of skipping ahead to the next timer interrupt')
     parser.add_argument('--timer', choices=['csr', 'mmio'], help="Enable machine timer")
     parser.add_argument('--uart', action="store_true", help='Enable UART')
     parser.add_argument('--blkdev', metavar="PATH", default=None, help='Enable MMIO block device')
@@ -166,11 +179,16 @@ if __name__ == '__main__':
         ram = SafeRAM_MMIO(MEMORY_SIZE, init=args.init_ram, logger=log)
 
     # CPU
+    if args.decode_cache_limit is not None:
+        set_decode_cache_limit(args.decode_cache_limit)
     cpu = CPU(ram, init_regs=args.init_regs, logger=log, trace_traps=args.traps, rvc_enabled=args.rvc)
 
     # System architecture
     machine = Machine(cpu, ram, timer=args.timer, mmio=use_mmio, rvc=args.rvc, logger=log,
-                      trace=args.trace, regs=args.regs, check_inv=args.check_inv, start_checks=args.start_checks)
+                      trace=args.trace, regs=args.regs, check_inv=args.check_inv, start_checks=args.start_checks,
+                      stop_checks=args.stop_checks, engine=args.engine, predecode=args.predecode, decode_cache_dir=args.decode_cache,
+                      intercept_libc=args.intercept_libc, intercept_softfloat=args.intercept_softfloat,
+                      idle_poll=args.idle_poll, wfi_fast_forward=args.wfi_fast_forward)
     
     # MMIO peripherals
     if args.uart:  # create and register UART peripheral
@@ -216,7 +234,9 @@ if __name__ == '__main__':
     # RUN
     try:
         if not args.gdb:
-            machine.run()
+            executed = machine.run(max_instructions=args.max_insns)
+            if args.max_insns is not None:
+                log.info(f"Instruction limit reached ({executed} instructions) at PC=0x{cpu.pc:08X}")
         else:
             # GDB debugging mode
             gdb_stub = GDBStub(cpu, ram, machine, logger=log, debug_protocol=args.gdb_debug)
@@ -252,4 +272,7 @@ if __name__ == '__main__':
     finally:
         if args.raw_tty:
             restore_terminal(stdin_fd, tty_old_settings)
+        machine.save_decode_cache()
+        if args.decode_cache_limit is not None:
+            log.info(f"Decode cache: {cpu.decoder.stats()} (16-bit: {cpu.decoder_compressed.stats()})")
         print()
@@ -13,6 +13,7 @@ from ram import SafeRAMOffset
 def parse_args():
     parser = argparse.ArgumentParser(description="RISC-V Test Runner")
     parser.add_argument("executable", nargs="?", help="exexutable test file")
+    parser.add_argument("--native", action="store_true", help="run the tests through the native accelerator (make native)")
     args = parser.parse_args(sys.argv[1:])
     return args
 
@@ -51,7 +52,8 @@ if __name__ == '__main__':
         # Instantiate CPU + RAM + machine + syscall handler
         ram = SafeRAMOffset(1024*1024, base_addr=0x8000_0000)  # RAM base and entry point at 0x8000_0000
         cpu = CPU(ram, rvc_enabled=True)  # Enable RVC for tests that use compressed instructions
-        machine = Machine(cpu, ram, rvc=True)  # Enable RVC for tests that use compressed instructions
+        # Optional native core: runs instructions up to the next one it leaves to the Python CPU
+        machine = Machine(cpu, ram, rvc=True, engine=('native' if args.native else 'interp'))
 
         # Load ELF file of test
         machine.load_elf(test_fname)
@@ -60,30 +62,8 @@ if __name__ == '__main__':
         tohost_addr = get_symbol_address(test_fname, "tohost")
         ram.store_word(tohost_addr, 0xFFFFFFFF)  # store sentinel value
 
-        # RUN
-        while True:
-            # Check PC alignment before
-            if cpu.pc & 0x1:
-                cpu.trap(cause=0, mtval=cpu.pc)  # Instruction address misaligned
-                cpu.pc = cpu.next_pc
-                continue
-
-            # Fetch
-            inst_low = ram.load_half(cpu.pc, signed=False)
-            if (inst_low & 0x3) == 0x3:
-                # 32-bit instruction: fetch upper 16 bits
-                inst_high = ram.load_half(cpu.pc + 2, signed=False)
-                inst = inst_low | (inst_high << 16)
-            else:
-                # 16-bit compressed instruction
-                inst = inst_low
-
-            cpu.execute(inst)
-            cpu.pc = cpu.next_pc
-
-            # if sentinel value has been overwritten, the test is over
-            if ram.load_word(tohost_addr) != 0xFFFFFFFF:
-                break
+        # RUN until the sentinel value has been overwritten (the test is over)
+        machine.run(until_store=tohost_addr)
 
         # Load and check test result
         test_result = ram.load_word(tohost_addr)
@@ -15,6 +15,8 @@
 # along with this program. If not, see <https://www.gnu.org/licenses/>.
 #
 
+import os, sys, hashlib, mmap, tempfile
+from array import array
 
 # Takes a 16-bit compressed instruction and returns its 32-bit equivalent.
 # Supports all RV32C instructions.
@@ -226,3 +228,89 @@ def expand_compressed(c_inst):
 
     # Invalid RVC instruction
     return (0, False)
+
+
+# Precomputed expansion table of the whole 16-bit encoding space.
+#
+# expansion_table() returns a sequence indexed by 16-bit instruction, holding the expanded 32-bit
+# instruction for each valid compressed encoding, and 0 for illegal encodings and for the halfwords
+# that are not compressed instructions (low bits 11); 0 is never a valid expansion.
+# The table is generated on first use and saved to __pycache__/, next to this module, so that later
+# runs memory-map it instead of expanding instructions again. The file is tagged with a hash of this
+# source file (and of the byte order), and is regenerated whenever the expander changes.
+
+TABLE_SIZE = 0x10000
+TABLE_FNAME = 'rvc_expansion.bin'
+
+rvc_table = None  # loaded table (see expansion_table)
+
+# Generate the expansion table (as an array of 32-bit words)
+def build_expansion_table():
+    table = array('I', bytes(4 * TABLE_SIZE))
+    for c_inst in range(TABLE_SIZE):
+        if (c_inst & 0x3) != 0x3:
+            expanded_inst, success = expand_compressed(c_inst)
+            if success:
+                table[c_inst] = expanded_inst
+    return table
+
+# Header of the table file: hash of the expander source and byte order
+def table_header(src_fname):
+    with open(src_fname, 'rb') as f:
+        h = hashlib.sha256(f.read())
+    h.update(sys.byteorder.encode())
+    return b'RVCT' + h.digest()
+
+# Memory-map the table file, returns None if missing or stale
+def map_table(fname, header):
+    try:
+        with open(fname, 'rb') as f:
+            mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):  # (mapping an empty file raises ValueError)
+        return None
+    if len(mm) != len(header) + 4 * TABLE_SIZE or mm[:len(header)] != header:
+        mm.close()
+        return None
+    return memoryview(mm)[len(header):].cast('I')
+
+# Save the table file (atomically, so that concurrent runs can generate it at the same time)
+def save_table(fname, header, table):
+    os.makedirs(os.path.dirname(fname), exist_ok=True)
+    fd, tmp_fname = tempfile.mkstemp(dir=os.path.dirname(fname), suffix='.tmp')
+    try:
+        os.chmod(tmp_fname, 0o644)  # (mkstemp creates private files)
+        with os.fdopen(fd, 'wb') as f:
+            f.write(header)
+            f.write(table.tobytes())
+        os.replace(tmp_fname, fname)
+    except BaseException:
+        os.unlink(tmp_fname)
+        raise
+
+# Returns the expansion table, loading (or generating) it on first use
+def expansion_table():
+    global rvc_table
+    if rvc_table is not None:
+        return rvc_table
+
+    src_dir = os.path.dirname(os.path.abspath(__file__))
+    fname = os.path.join(src_dir, '__pycache__', TABLE_FNAME)
+    try:
+        header = table_header(os.path.join(src_dir, 'rvc.py'))
+    except OSError:  # source not available: nothing to check the table file against
+        rvc_table = build_expansion_table()
+        return rvc_table
+
+    rvc_table = map_table(fname, header)
+    if rvc_table is None:
+        rvc_table = build_expansion_table()
+        try:
+            save_table(fname, header, rvc_table)
+        except OSError:
+            pass  # read-only install: keep the table in memory
+    return rvc_table
+
+# Same as expand_compressed(), using the expansion table
+def expand_compressed_table(c_inst):
+    expanded_inst = expansion_table()[c_inst]
+    return (expanded_inst, expanded_inst != 0)
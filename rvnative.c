@@ -0,0 +1,904 @@
+/*
+Copyright (2025) Ciro Cattuto <ciro.cattuto@gmail.com>
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License,
+or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Optional native accelerator for the emulator core (build with: make native)
+//
+// The Core object runs RV32IMC code directly over the RAM.memory bytearray and the
+// cpu.registers list. It only implements the "plain" part of the ISA: integer and M-extension
+// instructions, loads/stores, branches and jumps. It stops *before* any instruction it does not
+// handle (SYSTEM, MISC-MEM, AMOs, illegal encodings, misaligned control transfers, accesses outside
+// RAM or inside MMIO ranges), leaving cpu.pc on it: the Python CPU, which remains the reference
+// implementation, then executes that instruction (see Machine.run_native).
+//
+// Code is translated one basic block at a time into an array of pre-decoded operations
+// (operation kind, register numbers, ready-to-use immediates and targets), and blocks are chained
+// to their successors, so that the hot path does no decoding and no block lookups. Returns are
+// predicted by a return-address stack of the calling blocks, since the last-target chain of a
+// shared return instruction would mostly miss. Translated code is tracked in a bitmap (one bit per
+// halfword of RAM): native stores into translated code, as well as FENCE.I, discard all translated
+// blocks. Translated pages are also marked in the RAM page bitmap (ram.code_pages), so that stores
+// from Python and DMA into translated code discard it as well (through Core.invalidate).
+//
+// Blocks also stop before a set of "stop" PCs (the entry points of guest routines intercepted by
+// Python, see intercept.py), so that Python gets to run them.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <stdint.h>
+#include <string.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "rvnative requires a little-endian host"
+#endif
+
+#define MAX_MMIO_RANGES 16
+#define MAX_BLOCK_OPS 64
+#define HASH_BITS 16
+#define REG_SINK 32             // writes to x0 are translated into writes to this scratch register
+#define RAS_SIZE 32             // entries of the return-address stack (circular, oldest entries overwritten)
+#define RAM_CODE_PAGE_SHIFT 8   // granularity of the RAM translated code bitmap (ram.CODE_PAGE_SHIFT)
+
+// Operation kinds of translated instructions
+enum {
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+    OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+    OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+    OP_LI,                                  // LUI and AUIPC: imm is the final value
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+    OP_SB, OP_SH, OP_SW,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,  // imm is the branch target
+    OP_JAL,                                 // imm is the target, aux the return address
+    OP_JALR,                                // aux is the return address
+    OP_STOP,                                // instruction left to Python
+    OP_FENCE_I,                             // FENCE.I: discard translated code, then left to Python
+};
+
+// How blocks ending with a jump are treated by the return-address stack (standard RISC-V hints:
+// x1 and x5 are link registers)
+enum {
+    EXIT_OTHER,
+    EXIT_CALL,                              // JAL/JALR writing a link register: push the block
+    EXIT_RETURN,                            // JALR through a link register (e.g., ret): pop a block
+};
+
+typedef struct {
+    uint8_t kind, rd, rs1, rs2;
+    uint32_t imm;
+    uint32_t aux;
+    uint32_t pc;
+} Op;
+
+typedef struct Block Block;
+struct Block {
+    uint32_t start_pc;
+    uint32_t end_pc;            // PC following the last instruction (fall-through)
+    uint32_t chain_pc;          // PC of the chained taken/indirect successor
+    uint32_t n_ops;
+    uint32_t exit;              // EXIT_* kind of the terminating jump
+    Block *fall_through;        // chained successors (NULL until first used)
+    Block *chain;
+    Block *hash_next;
+    Block *all_next;
+    Op ops[];
+};
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *cpu;
+    PyObject *expand;           // rvc.expand_compressed()
+    Py_buffer view;             // RAM.memory
+    uint8_t *mem;
+    uint32_t base;              // guest address of mem[0]
+    uint32_t size;              // RAM size (padding bytes excluded)
+    uint32_t alignment_mask;    // control transfer alignment (cpu.alignment_mask)
+    int compressed;             // dispatch 16-bit instructions (otherwise left to Python)
+    int n_mmio;
+    uint32_t mmio[MAX_MMIO_RANGES][2];
+    uint32_t *rvc_table;        // 16-bit instruction -> expanded instruction (0: not yet expanded, 1: illegal)
+    uint32_t *stops;            // PCs always left to Python
+    Py_ssize_t n_stops;
+    Block **hash;               // start PC -> translated block
+    Block *all_blocks;
+    uint8_t *code_map;          // one bit per RAM halfword covered by translated code
+    Py_buffer pages_view;       // RAM.code_pages (if the RAM notifies stores into translated code)
+    uint8_t *ram_code_pages;    // one byte per RAM page holding translated code, checked by Python stores
+    Block *ras[RAS_SIZE];       // return-address stack: calling blocks (returns go to their fall-through)
+    uint32_t ras_top;           // index of the next free entry (modulo RAS_SIZE)
+    uint32_t ras_depth;         // number of valid entries
+    Py_ssize_t n_blocks;
+    Py_ssize_t n_flushes;
+    Py_ssize_t n_ras_hits;
+    Py_ssize_t n_ras_misses;
+} CoreObject;
+
+static PyObject *str_pc, *str_registers, *str_reservation_valid;
+
+// Host pointer for an n-byte access, or NULL if the access must go through Python
+static inline uint8_t *mem_ptr(CoreObject *self, uint32_t addr, uint32_t n)
+{
+    uint32_t offset = addr - self->base;
+    if (offset > self->size - n)
+        return NULL;
+    for (int i = 0; i < self->n_mmio; i++)
+        if (addr < self->mmio[i][1] && addr + n > self->mmio[i][0])
+            return NULL;
+    return self->mem + offset;
+}
+
+static inline uint32_t load32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint16_t load16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+
+// Translated code bitmap (offsets are relative to the start of RAM)
+// The RAM page bitmap makes stores from Python (and DMA) into translated code call Core.invalidate(),
+// see ram.py. Python stores only check the page of their first byte, hence the 3 bytes before the code.
+static inline void mark_code(CoreObject *self, uint32_t offset, uint32_t n)
+{
+    for (uint32_t hw = offset >> 1; hw <= (offset + n - 1) >> 1; hw++)
+        self->code_map[hw >> 3] |= 1 << (hw & 7);
+    if (self->ram_code_pages != NULL)
+        for (uint32_t page = (offset < 3 ? 0 : offset - 3) >> RAM_CODE_PAGE_SHIFT; page <= (offset + n - 1) >> RAM_CODE_PAGE_SHIFT; page++)
+            self->ram_code_pages[page] = 1;
+}
+
+static inline int is_code(CoreObject *self, uint8_t *p, uint32_t n)
+{
+    uint32_t offset = (uint32_t)(p - self->mem);
+    for (uint32_t hw = offset >> 1; hw <= (offset + n - 1) >> 1; hw++)
+        if (self->code_map[hw >> 3] & (1 << (hw & 7)))
+            return 1;
+    return 0;
+}
+
+static inline uint32_t hash_pc(uint32_t pc)
+{
+    return ((pc >> 1) * 0x9E3779B1u) >> (32 - HASH_BITS);
+}
+
+// Discard all translated blocks
+static void flush(CoreObject *self)
+{
+    Block *b = self->all_blocks;
+    while (b != NULL) {
+        Block *next = b->all_next;
+        PyMem_Free(b);
+        b = next;
+    }
+    self->all_blocks = NULL;
+    memset(self->hash, 0, sizeof(Block *) << HASH_BITS);
+    memset(self->code_map, 0, ((self->size >> 1) + 8) >> 3);
+    self->ras_depth = 0;  // (entries point to discarded blocks)
+    self->n_blocks = 0;
+    self->n_flushes++;
+}
+
+// Expand a 16-bit instruction through rvc.expand_compressed() and cache the result
+static int expand(CoreObject *self, uint32_t inst16)
+{
+    PyObject *res = PyObject_CallFunction(self->expand, "I", (unsigned int)inst16);
+    if (res == NULL)
+        return -1;
+    PyObject *expanded, *success;
+    if (!PyArg_ParseTuple(res, "OO", &expanded, &success)) {
+        Py_DECREF(res);
+        return -1;
+    }
+    int ok = PyObject_IsTrue(success);
+    uint32_t inst = (uint32_t)PyLong_AsUnsignedLongMask(expanded);
+    Py_DECREF(res);
+    if (ok < 0 || PyErr_Occurred())
+        return -1;
+    self->rvc_table[inst16] = ok ? inst : 1;
+    return 0;
+}
+
+// Fetch the (expanded) instruction at pc: returns 1 on success, 0 if it cannot run natively, -1 on error
+static int fetch(CoreObject *self, uint32_t pc, uint32_t *inst, uint32_t *len)
+{
+    uint32_t offset = pc - self->base;
+    if (offset > self->size - 2)
+        return 0;
+    uint32_t value = load16(self->mem + offset);
+    if ((value & 0x3) == 0x3) {
+        if (offset > self->size - 4)
+            return 0;
+        *inst = load32(self->mem + offset);
+        *len = 4;
+        return 1;
+    }
+    if (!self->compressed)
+        return 0;
+    if (self->rvc_table[value] == 0 && expand(self, value) < 0)
+        return -1;
+    if (self->rvc_table[value] == 1)
+        return 0;  // illegal compressed instruction
+    *inst = self->rvc_table[value];
+    *len = 2;
+    return 1;
+}
+
+// Decode an instruction into op, returns 1 if it ends the block
+static int decode(CoreObject *self, Op *op, uint32_t inst, uint32_t pc, uint32_t len)
+{
+    static const uint8_t rtype[8] = { OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND };
+    static const uint8_t mtype[8] = { OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU };
+    static const uint8_t itype[8] = { OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI };
+    static const uint8_t loads[8] = { OP_LB, OP_LH, OP_LW, OP_STOP, OP_LBU, OP_LHU, OP_STOP, OP_STOP };
+    static const uint8_t stores[8] = { OP_SB, OP_SH, OP_SW, OP_STOP, OP_STOP, OP_STOP, OP_STOP, OP_STOP };
+    static const uint8_t branches[8] = { OP_BEQ, OP_BNE, OP_STOP, OP_STOP, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU };
+
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t funct7 = inst >> 25;
+    uint32_t imm_i = (uint32_t)((int32_t)inst >> 20);
+    op->rd = (inst >> 7) & 0x1F;
+    if (op->rd == 0)
+        op->rd = REG_SINK;
+    op->rs1 = (inst >> 15) & 0x1F;
+    op->rs2 = (inst >> 20) & 0x1F;
+    op->kind = OP_STOP;
+
+    switch (inst & 0x7F) {
+    case 0x33:  // R-type
+        if (funct7 == 0x00)
+            op->kind = rtype[funct3];
+        else if (funct7 == 0x01)
+            op->kind = mtype[funct3];
+        else if (funct7 == 0x20 && funct3 == 0x0)
+            op->kind = OP_SUB;
+        else if (funct7 == 0x20 && funct3 == 0x5)
+            op->kind = OP_SRA;
+        return op->kind == OP_STOP;
+
+    case 0x13:  // I-type
+        op->kind = itype[funct3];
+        op->imm = imm_i;
+        if (funct3 == 0x1 || funct3 == 0x5) {
+            op->imm = op->rs2;  // shift amount
+            if (funct3 == 0x5 && funct7 == 0x20)
+                op->kind = OP_SRAI;
+            else if (funct7 != 0x00)
+                op->kind = OP_STOP;
+        }
+        return op->kind == OP_STOP;
+
+    case 0x03:  // Loads
+        op->kind = loads[funct3];
+        op->imm = imm_i;
+        return op->kind == OP_STOP;
+
+    case 0x23:  // Stores
+        op->kind = stores[funct3];
+        op->imm = (uint32_t)(((int32_t)inst >> 20) & ~0x1F) | ((inst >> 7) & 0x1F);
+        return op->kind == OP_STOP;
+
+    case 0x63:  // Branches (misaligned targets are checked when taken)
+        op->kind = branches[funct3];
+        op->imm = pc + (((inst >> 7) & 0x1) << 11 | ((inst >> 8) & 0xF) << 1 |
+                        ((inst >> 25) & 0x3F) << 5 | (uint32_t)((int32_t)inst >> 31) << 12);
+        return 1;
+
+    case 0x37:  // LUI
+        op->kind = OP_LI;
+        op->imm = inst & 0xFFFFF000;
+        return 0;
+
+    case 0x17:  // AUIPC
+        op->kind = OP_LI;
+        op->imm = pc + (inst & 0xFFFFF000);
+        return 0;
+
+    case 0x6F:  // JAL
+        op->imm = pc + (((inst >> 21) & 0x3FF) << 1 | ((inst >> 20) & 0x1) << 11 |
+                        ((inst >> 12) & 0xFF) << 12 | (uint32_t)((int32_t)inst >> 31) << 20);
+        op->aux = pc + len;
+        if (!(op->imm & self->alignment_mask))
+            op->kind = OP_JAL;
+        return 1;
+
+    case 0x67:  // JALR
+        if (funct3 == 0x0)
+            op->kind = OP_JALR;
+        op->imm = imm_i;
+        op->aux = pc + len;
+        return 1;
+
+    case 0x0F:  // MISC-MEM
+        if (funct3 == 0x1)
+            op->kind = OP_FENCE_I;
+        return 1;
+
+    default:  // SYSTEM, AMOs and illegal opcodes
+        return 1;
+    }
+}
+
+static inline int is_link(uint32_t reg) { return reg == 1 || reg == 5; }
+
+// Return-address stack treatment of a block ending with op
+static uint32_t exit_kind(const Op *op)
+{
+    if ((op->kind == OP_JAL || op->kind == OP_JALR) && is_link(op->rd))
+        return EXIT_CALL;
+    if (op->kind == OP_JALR && is_link(op->rs1))
+        return EXIT_RETURN;
+    return EXIT_OTHER;
+}
+
+static int is_stop(CoreObject *self, uint32_t pc)
+{
+    for (Py_ssize_t i = 0; i < self->n_stops; i++)
+        if (self->stops[i] == pc)
+            return 1;
+    return 0;
+}
+
+static Block *lookup(CoreObject *self, uint32_t pc)
+{
+    for (Block *b = self->hash[hash_pc(pc)]; b != NULL; b = b->hash_next)
+        if (b->start_pc == pc)
+            return b;
+    return NULL;
+}
+
+// Translate the basic block starting at start_pc (ending at the first branch, jump,
+// instruction left to Python or stop PC), returns NULL on error
+static Block *translate(CoreObject *self, uint32_t start_pc)
+{
+    Op ops[MAX_BLOCK_OPS];
+    uint32_t n_ops = 0;
+    uint32_t pc = start_pc;
+
+    for (;;) {
+        Op *op = &ops[n_ops++];
+        memset(op, 0, sizeof(Op));
+        op->pc = pc;
+        op->kind = OP_STOP;
+        if (self->n_stops > 0 && is_stop(self, pc))
+            break;
+
+        uint32_t inst, len;
+        int res = fetch(self, pc, &inst, &len);
+        if (res < 0)
+            return NULL;
+        if (res == 0)
+            break;
+
+        int end = decode(self, op, inst, pc, len);
+        mark_code(self, pc - self->base, len);
+        pc += len;
+        if (end || n_ops == MAX_BLOCK_OPS)
+            break;
+    }
+
+    Block *b = PyMem_Malloc(sizeof(Block) + n_ops * sizeof(Op));
+    if (b == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    b->start_pc = start_pc;
+    b->end_pc = pc;
+    b->chain_pc = 0;
+    b->n_ops = n_ops;
+    b->exit = exit_kind(&ops[n_ops - 1]);
+    b->fall_through = NULL;
+    b->chain = NULL;
+    memcpy(b->ops, ops, n_ops * sizeof(Op));
+
+    uint32_t h = hash_pc(start_pc);
+    b->hash_next = self->hash[h];
+    self->hash[h] = b;
+    b->all_next = self->all_blocks;
+    self->all_blocks = b;
+    self->n_blocks++;
+    return b;
+}
+
+static inline Block *get_block(CoreObject *self, uint32_t pc)
+{
+    Block *b = lookup(self, pc);
+    return b != NULL ? b : translate(self, pc);
+}
+
+// Core.run(budget): execute up to budget instructions starting at cpu.pc, returns the number of
+// executed instructions. cpu.pc and cpu.registers are updated on return.
+static PyObject *Core_run(CoreObject *self, PyObject *arg)
+{
+    Py_ssize_t budget = PyLong_AsSsize_t(arg);
+    if (budget == -1 && PyErr_Occurred())
+        return NULL;
+
+    PyObject *registers = PyObject_GetAttr(self->cpu, str_registers);
+    if (registers == NULL)
+        return NULL;
+    if (!PyList_Check(registers) || PyList_GET_SIZE(registers) != 32) {
+        Py_DECREF(registers);
+        PyErr_SetString(PyExc_TypeError, "cpu.registers must be a list of 32 integers");
+        return NULL;
+    }
+    PyObject *pc_obj = PyObject_GetAttr(self->cpu, str_pc);
+    if (pc_obj == NULL) {
+        Py_DECREF(registers);
+        return NULL;
+    }
+    uint32_t pc = (uint32_t)PyLong_AsUnsignedLongMask(pc_obj);
+    Py_DECREF(pc_obj);
+
+    uint32_t x[33], saved[32];
+    for (int i = 0; i < 32; i++)
+        x[i] = saved[i] = (uint32_t)PyLong_AsUnsignedLongMask(PyList_GET_ITEM(registers, i));
+    if (PyErr_Occurred()) {
+        Py_DECREF(registers);
+        return NULL;
+    }
+
+    const uint32_t amask = self->alignment_mask;
+    int stored = 0;
+    int error = 0;
+    Py_ssize_t n = 0;
+    Block *b = NULL;
+
+    while (n < budget) {
+        if (b == NULL && (b = get_block(self, pc)) == NULL) {
+            error = 1;
+            break;
+        }
+
+        uint32_t next_pc = b->end_pc;
+        const Op *op = b->ops;
+        const Op *end = op + b->n_ops;
+        const Op *limit = budget - n < b->n_ops ? op + (budget - n) : end;
+        for (; op < limit; op++) {
+            uint32_t a = x[op->rs1], c = x[op->rs2];
+            uint32_t target;
+            uint8_t *p;
+
+            switch (op->kind) {
+            case OP_ADD: x[op->rd] = a + c; break;
+            case OP_SUB: x[op->rd] = a - c; break;
+            case OP_SLL: x[op->rd] = a << (c & 0x1F); break;
+            case OP_SLT: x[op->rd] = (int32_t)a < (int32_t)c; break;
+            case OP_SLTU: x[op->rd] = a < c; break;
+            case OP_XOR: x[op->rd] = a ^ c; break;
+            case OP_SRL: x[op->rd] = a >> (c & 0x1F); break;
+            case OP_SRA: x[op->rd] = (uint32_t)((int32_t)a >> (c & 0x1F)); break;
+            case OP_OR: x[op->rd] = a | c; break;
+            case OP_AND: x[op->rd] = a & c; break;
+
+            case OP_MUL: x[op->rd] = a * c; break;
+            case OP_MULH: x[op->rd] = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)c) >> 32); break;
+            case OP_MULHSU: x[op->rd] = (uint32_t)(((int64_t)(int32_t)a * (int64_t)c) >> 32); break;
+            case OP_MULHU: x[op->rd] = (uint32_t)(((uint64_t)a * (uint64_t)c) >> 32); break;
+            case OP_DIV:
+                if (c == 0) x[op->rd] = 0xFFFFFFFF;
+                else if (a == 0x80000000 && c == 0xFFFFFFFF) x[op->rd] = 0x80000000;
+                else x[op->rd] = (uint32_t)((int32_t)a / (int32_t)c);
+                break;
+            case OP_DIVU: x[op->rd] = c == 0 ? 0xFFFFFFFF : a / c; break;
+            case OP_REM:
+                if (c == 0) x[op->rd] = a;
+                else if (a == 0x80000000 && c == 0xFFFFFFFF) x[op->rd] = 0;
+                else x[op->rd] = (uint32_t)((int32_t)a % (int32_t)c);
+                break;
+            case OP_REMU: x[op->rd] = c == 0 ? a : a % c; break;
+
+            case OP_ADDI: x[op->rd] = a + op->imm; break;
+            case OP_SLTI: x[op->rd] = (int32_t)a < (int32_t)op->imm; break;
+            case OP_SLTIU: x[op->rd] = a < op->imm; break;
+            case OP_XORI: x[op->rd] = a ^ op->imm; break;
+            case OP_ORI: x[op->rd] = a | op->imm; break;
+            case OP_ANDI: x[op->rd] = a & op->imm; break;
+            case OP_SLLI: x[op->rd] = a << op->imm; break;
+            case OP_SRLI: x[op->rd] = a >> op->imm; break;
+            case OP_SRAI: x[op->rd] = (uint32_t)((int32_t)a >> op->imm); break;
+            case OP_LI: x[op->rd] = op->imm; break;
+
+            case OP_LB:
+                if (!(p = mem_ptr(self, a + op->imm, 1))) { pc = op->pc; goto stop; }
+                x[op->rd] = (uint32_t)(int8_t)p[0];
+                break;
+            case OP_LH:
+                if (!(p = mem_ptr(self, a + op->imm, 2))) { pc = op->pc; goto stop; }
+                x[op->rd] = (uint32_t)(int16_t)load16(p);
+                break;
+            case OP_LW:
+                if (!(p = mem_ptr(self, a + op->imm, 4))) { pc = op->pc; goto stop; }
+                x[op->rd] = load32(p);
+                break;
+            case OP_LBU:
+                if (!(p = mem_ptr(self, a + op->imm, 1))) { pc = op->pc; goto stop; }
+                x[op->rd] = p[0];
+                break;
+            case OP_LHU:
+                if (!(p = mem_ptr(self, a + op->imm, 2))) { pc = op->pc; goto stop; }
+                x[op->rd] = load16(p);
+                break;
+
+            case OP_SB:
+            case OP_SH:
+            case OP_SW: {
+                uint32_t size = op->kind == OP_SB ? 1 : op->kind == OP_SH ? 2 : 4;
+                if (!(p = mem_ptr(self, a + op->imm, size))) { pc = op->pc; goto stop; }
+                memcpy(p, &c, size);
+                stored = 1;
+                if (is_code(self, p, size)) {  // store into translated code: retranslate from the next instruction
+                    pc = op + 1 < end ? op[1].pc : b->end_pc;
+                    flush(self);
+                    n++;
+                    b = NULL;
+                    goto next_block;
+                }
+                break;
+            }
+
+            case OP_BEQ: if (a == c) goto branch; break;
+            case OP_BNE: if (a != c) goto branch; break;
+            case OP_BLT: if ((int32_t)a < (int32_t)c) goto branch; break;
+            case OP_BGE: if ((int32_t)a >= (int32_t)c) goto branch; break;
+            case OP_BLTU: if (a < c) goto branch; break;
+            case OP_BGEU: if (a >= c) goto branch; break;
+            branch:
+                if (op->imm & amask) { pc = op->pc; goto stop; }  // misaligned target: trap
+                next_pc = op->imm;
+                break;
+
+            case OP_JAL:
+                x[op->rd] = op->aux;
+                next_pc = op->imm;
+                break;
+
+            case OP_JALR:
+                target = (a + op->imm) & ~1u;
+                if (target & amask) { pc = op->pc; goto stop; }
+                x[op->rd] = op->aux;
+                next_pc = target;
+                break;
+
+            case OP_FENCE_I:
+                flush(self);  // (then executed by Python)
+                // fall through
+            case OP_STOP:
+                pc = op->pc;
+                goto stop;
+            }
+
+            n++;
+        }
+        if (op < end) {  // out of budget
+            pc = op->pc;
+            goto stop;
+        }
+
+        // follow (and create) the chain to the next block
+        pc = next_pc;
+        if (b->exit == EXIT_CALL) {  // calls return to the fall-through of the calling block
+            self->ras[self->ras_top] = b;
+            self->ras_top = (self->ras_top + 1) % RAS_SIZE;
+            if (self->ras_depth < RAS_SIZE)
+                self->ras_depth++;
+        } else if (b->exit == EXIT_RETURN && self->ras_depth > 0) {
+            self->ras_top = (self->ras_top + RAS_SIZE - 1) % RAS_SIZE;
+            self->ras_depth--;
+            Block *caller = self->ras[self->ras_top];
+            if (next_pc == caller->end_pc) {
+                self->n_ras_hits++;
+                if (caller->fall_through == NULL && (caller->fall_through = get_block(self, next_pc)) == NULL) {
+                    error = 1;
+                    break;
+                }
+                b = caller->fall_through;
+                continue;
+            }
+            self->n_ras_misses++;  // (e.g., longjmp or a task switch): look the block up as usual
+        }
+        if (next_pc == b->end_pc) {
+            if (b->fall_through == NULL)
+                b->fall_through = get_block(self, next_pc);
+            b = b->fall_through;
+        } else if (next_pc == b->chain_pc && b->chain != NULL) {
+            b = b->chain;
+        } else {
+            Block *next = get_block(self, next_pc);
+            b->chain_pc = next_pc;
+            b->chain = next;
+            b = next;
+        }
+        if (b == NULL) {
+            error = 1;
+            break;
+        }
+    next_block: ;
+    }
+stop:
+
+    // write back state
+    for (int i = 1; i < 32; i++) {
+        if (x[i] != saved[i]) {
+            PyObject *value = PyLong_FromUnsignedLong(x[i]);
+            if (value == NULL) {
+                error = 1;
+                break;
+            }
+            PyList_SetItem(registers, i, value);
+        }
+    }
+    Py_DECREF(registers);
+
+    if (!error) {
+        PyObject *value = PyLong_FromUnsignedLong(pc);
+        if (value == NULL || PyObject_SetAttr(self->cpu, str_pc, value) < 0)
+            error = 1;
+        Py_XDECREF(value);
+    }
+    if (!error && stored && PyObject_SetAttr(self->cpu, str_reservation_valid, Py_False) < 0)
+        error = 1;  // stores clear any LR/SC reservation
+
+    if (error)
+        return NULL;
+    return PyLong_FromSsize_t(n);
+}
+
+// Core.flush(): discard all translated code (e.g., after code was modified from Python)
+static PyObject *Core_flush(CoreObject *self, PyObject *unused)
+{
+    flush(self);
+    Py_RETURN_NONE;
+}
+
+// Core.invalidate(addr, size): discard all translated code if guest memory range [addr, addr+size)
+// overlaps it (e.g., after the range was written from Python)
+static PyObject *Core_invalidate(CoreObject *self, PyObject *args)
+{
+    unsigned int addr, size;
+    if (!PyArg_ParseTuple(args, "II", &addr, &size))
+        return NULL;
+    uint32_t offset = addr - self->base;
+    if (size > 0 && offset < self->size) {
+        if (size > self->size - offset)
+            size = self->size - offset;
+        if (is_code(self, self->mem + offset, size))
+            flush(self);
+    }
+    Py_RETURN_NONE;
+}
+
+// Core.set_stops(pcs): set the PCs always left to Python (discards all translated code)
+static PyObject *Core_set_stops(CoreObject *self, PyObject *arg)
+{
+    PyObject *seq = PySequence_Fast(arg, "stops must be a sequence of addresses");
+    if (seq == NULL)
+        return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    uint32_t *stops = PyMem_Calloc(count > 0 ? count : 1, sizeof(uint32_t));
+    if (stops == NULL) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < count; i++)
+        stops[i] = (uint32_t)PyLong_AsUnsignedLongMask(PySequence_Fast_GET_ITEM(seq, i));
+    Py_DECREF(seq);
+    if (PyErr_Occurred()) {
+        PyMem_Free(stops);
+        return NULL;
+    }
+    PyMem_Free(self->stops);
+    self->stops = stops;
+    self->n_stops = count;
+    flush(self);
+    Py_RETURN_NONE;
+}
+
+// Core(cpu, ram, compressed, expand)
+static int Core_init(CoreObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"cpu", "ram", "compressed", "expand", NULL};
+    PyObject *cpu, *ram, *expand;
+    int compressed;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOpO", kwlist, &cpu, &ram, &compressed, &expand))
+        return -1;
+    if (self->mem != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Core already initialized");
+        return -1;
+    }
+
+    PyObject *memory = PyObject_GetAttrString(ram, "memory");
+    if (memory == NULL)
+        return -1;
+    int res = PyObject_GetBuffer(memory, &self->view, PyBUF_WRITABLE);
+    Py_DECREF(memory);
+    if (res < 0)
+        return -1;
+    self->mem = self->view.buf;
+
+    PyObject *size = PyObject_GetAttrString(ram, "size");
+    if (size == NULL)
+        return -1;
+    unsigned long long ram_size = PyLong_AsUnsignedLongLong(size);
+    Py_DECREF(size);
+    if (PyErr_Occurred())
+        return -1;
+    if (ram_size < 4 || ram_size > (unsigned long long)self->view.len || ram_size > 0xFFFFFFFFull) {
+        PyErr_SetString(PyExc_ValueError, "Invalid RAM size");
+        return -1;
+    }
+    self->size = (uint32_t)ram_size;
+
+    self->base = 0;
+    PyObject *base = PyObject_GetAttrString(ram, "base_addr");
+    if (base != NULL) {
+        self->base = (uint32_t)PyLong_AsUnsignedLongMask(base);
+        Py_DECREF(base);
+        if (PyErr_Occurred())
+            return -1;
+    } else {
+        PyErr_Clear();
+    }
+
+    self->n_mmio = 0;
+    PyObject *mmio_ranges = PyObject_GetAttrString(ram, "mmio_ranges");
+    if (mmio_ranges != NULL) {
+        PyObject *seq = PySequence_Fast(mmio_ranges, "ram.mmio_ranges must be a sequence");
+        Py_DECREF(mmio_ranges);
+        if (seq == NULL)
+            return -1;
+        Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+        if (count > MAX_MMIO_RANGES) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_ValueError, "Too many MMIO ranges");
+            return -1;
+        }
+        for (Py_ssize_t i = 0; i < count; i++) {
+            PyObject *range = PySequence_Fast_GET_ITEM(seq, i);
+            PyObject *lo = PySequence_GetItem(range, 0);
+            PyObject *hi = PySequence_GetItem(range, 1);
+            if (lo != NULL && hi != NULL) {
+                self->mmio[i][0] = (uint32_t)PyLong_AsUnsignedLongMask(lo);
+                self->mmio[i][1] = (uint32_t)PyLong_AsUnsignedLongMask(hi);
+            }
+            Py_XDECREF(lo);
+            Py_XDECREF(hi);
+            if (PyErr_Occurred()) {
+                Py_DECREF(seq);
+                return -1;
+            }
+        }
+        self->n_mmio = (int)count;
+        Py_DECREF(seq);
+    } else {
+        PyErr_Clear();
+    }
+
+    self->ram_code_pages = NULL;
+    PyObject *code_written = PyObject_GetAttrString(ram, "code_written");
+    if (code_written != NULL && code_written != Py_None) {
+        PyObject *pages = PyObject_GetAttrString(ram, "code_pages");
+        res = pages != NULL ? PyObject_GetBuffer(pages, &self->pages_view, PyBUF_WRITABLE) : -1;
+        Py_XDECREF(pages);
+        if (res < 0) {
+            Py_DECREF(code_written);
+            return -1;
+        }
+        if ((uint64_t)self->pages_view.len <= ((self->size - 1) >> RAM_CODE_PAGE_SHIFT)) {
+            Py_DECREF(code_written);
+            PyBuffer_Release(&self->pages_view);
+            PyErr_SetString(PyExc_ValueError, "Invalid RAM code page bitmap size");
+            return -1;
+        }
+        self->ram_code_pages = self->pages_view.buf;
+    }
+    Py_XDECREF(code_written);
+    PyErr_Clear();  // (RAM without translated code tracking)
+
+    PyObject *mask = PyObject_GetAttrString(cpu, "alignment_mask");
+    if (mask == NULL)
+        return -1;
+    self->alignment_mask = (uint32_t)PyLong_AsUnsignedLongMask(mask);
+    Py_DECREF(mask);
+    if (PyErr_Occurred())
+        return -1;
+
+    self->rvc_table = PyMem_Calloc(0x10000, sizeof(uint32_t));
+    self->hash = PyMem_Calloc((size_t)1 << HASH_BITS, sizeof(Block *));
+    self->code_map = PyMem_Calloc(((self->size >> 1) + 8) >> 3, 1);
+    if (self->rvc_table == NULL || self->hash == NULL || self->code_map == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    self->compressed = compressed;
+    Py_INCREF(cpu);
+    self->cpu = cpu;
+    Py_INCREF(expand);
+    self->expand = expand;
+    return 0;
+}
+
+static void Core_dealloc(CoreObject *self)
+{
+    if (self->hash != NULL && self->code_map != NULL)
+        flush(self);
+    if (self->mem != NULL)
+        PyBuffer_Release(&self->view);
+    if (self->ram_code_pages != NULL)
+        PyBuffer_Release(&self->pages_view);
+    PyMem_Free(self->rvc_table);
+    PyMem_Free(self->stops);
+    PyMem_Free(self->hash);
+    PyMem_Free(self->code_map);
+    Py_XDECREF(self->cpu);
+    Py_XDECREF(self->expand);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef Core_methods[] = {
+    {"run", (PyCFunction)Core_run, METH_O,
+     "run(budget) -> number of executed instructions (stops before instructions left to Python)"},
+    {"flush", (PyCFunction)Core_flush, METH_NOARGS, "flush(): discard all translated code"},
+    {"invalidate", (PyCFunction)Core_invalidate, METH_VARARGS,
+     "invalidate(addr, size): discard all translated code if it overlaps the given guest memory range"},
+    {"set_stops", (PyCFunction)Core_set_stops, METH_O, "set_stops(pcs): set the PCs always left to Python"},
+    {NULL}
+};
+
+static PyMemberDef Core_members[] = {
+    {"blocks", T_PYSSIZET, offsetof(CoreObject, n_blocks), READONLY, "number of translated blocks"},
+    {"flushes", T_PYSSIZET, offsetof(CoreObject, n_flushes), READONLY, "number of translation cache flushes"},
+    {"ras_hits", T_PYSSIZET, offsetof(CoreObject, n_ras_hits), READONLY, "returns predicted by the return-address stack"},
+    {"ras_misses", T_PYSSIZET, offsetof(CoreObject, n_ras_misses), READONLY, "returns mispredicted by the return-address stack"},
+    {NULL}
+};
+
+static PyTypeObject CoreType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "rvnative.Core",
+    .tp_doc = "Native RV32IMC execution core over the RAM and CPU state of the emulator",
+    .tp_basicsize = sizeof(CoreObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Core_init,
+    .tp_dealloc = (destructor)Core_dealloc,
+    .tp_methods = Core_methods,
+    .tp_members = Core_members,
+};
+
+static struct PyModuleDef rvnative_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "rvnative",
+    .m_doc = "Optional native accelerator for the RISC-V emulator core",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_rvnative(void)
+{
+    str_pc = PyUnicode_InternFromString("pc");
+    str_registers = PyUnicode_InternFromString("registers");
+    str_reservation_valid = PyUnicode_InternFromString("reservation_valid");
+    if (str_pc == NULL || str_registers == NULL || str_reservation_valid == NULL)
+        return NULL;
+    if (PyType_Ready(&CoreType) < 0)
+        return NULL;
+
+    PyObject *m = PyModule_Create(&rvnative_module);
+    if (m == NULL)
+        return NULL;
+    Py_INCREF(&CoreType);
+    if (PyModule_AddObject(m, "Core", (PyObject *)&CoreType) < 0) {
+        Py_DECREF(&CoreType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
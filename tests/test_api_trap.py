@@ -16,14 +16,8 @@ cpu.pc = 0x00000000
 cpu.csrs[0x305] = 0xDEAD0000 # set MTVEC address
 
 # Run the program
-while True:
-    inst = ram.load_word(cpu.pc)  # fetch
-    cpu.execute(inst)             # decode and execute
-    cpu.pc = cpu.next_pc          # update program counter
-
-    # When pc == 0xDEAD0000 we know a trap (the ECALL in start_bare.S) has occurred and we stop execution.
-    if cpu.pc == 0xDEAD0000:
-        break
+# When pc == 0xDEAD0000 we know a trap (the ECALL in start_bare.S) has occurred and we stop execution.
+machine.run(until_pc=0xDEAD0000)
 
 print ("Result =", cpu.registers[10])  # Print the return value (value of register a0/x10, should be 4950)
 
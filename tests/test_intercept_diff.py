@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Differential check of the host-native libc routines (--intercept-libc, see intercept.py)
+# against the emulated routines of an ELF executable, e.g.:
+#
+#   PYTHONPATH=. python tests/test_intercept_diff.py prebuilt/micropython.elf
+#
+# Each routine is called with random arguments over a scratch buffer, once emulated and once
+# host-native, and the results and the buffer contents are compared. Comparisons (memcmp, strcmp)
+# only need to agree in sign. Calls the host-native routine falls back on are counted, not compared.
+
+import sys, random, logging
+from elftools.elf.elffile import ELFFile
+from machine import Machine
+from cpu import CPU
+from ram import RAM
+from intercept import LibcIntercepts, LIBC_ROUTINES
+
+elf = sys.argv[1] if len(sys.argv) > 1 else "prebuilt/test_newlib_softfloat.elf"
+CALLS = 300         # calls per routine
+RAM_SIZE = 4 * 1024 * 1024
+BUF = RAM_SIZE - 0x1000   # scratch buffer (at the top of RAM, above the stack)
+BUF_SIZE = 256
+RETURN = 0xDEAD0000       # return address: the emulated routine returns here
+
+# function addresses by name, and whether the executable uses compressed instructions
+with open(elf, 'rb') as f:
+    elffile = ELFFile(f)
+    rvc = bool(elffile.header.e_flags & 0x1)  # EF_RISCV_RVC
+    functions = { sym.name: sym['st_value'] for sym in elffile.get_section_by_name('.symtab').iter_symbols()
+                  if sym['st_info']['type'] == 'STT_FUNC' }
+
+log = logging.getLogger(__name__)
+ram = RAM(RAM_SIZE, logger=log)
+cpu = CPU(ram, logger=log, rvc_enabled=rvc)
+machine = Machine(cpu, ram, logger=log, rvc=rvc)
+machine.load_elf(elf)
+host = LibcIntercepts(cpu, ram, lambda addr, size: None)
+
+# Call the emulated routine at addr and return a0
+def emulate(addr, args):
+    regs = cpu.registers
+    regs[1] = RETURN
+    regs[2] = BUF - 16  # sp
+    for i, arg in enumerate(args):
+        regs[10 + i] = arg
+    cpu.pc = addr
+    machine.run(until_pc=RETURN, max_instructions=1_000_000)
+    return regs[10]
+
+def sign(x):
+    x = x - (1 << 32) if x & 0x80000000 else x
+    return (x > 0) - (x < 0)
+
+rnd = random.Random(1)
+mismatches = 0
+for name in LIBC_ROUTINES:
+    if name not in functions:
+        print(f"{name}: not found")
+        continue
+    compared = fallbacks = 0
+    for _ in range(CALLS):
+        # strings of a few characters, with bytes that sort on either side of the sign bit
+        data = bytes(rnd.choice(b'ab\x00\x80\xff') for _ in range(BUF_SIZE))
+        a, b, n = BUF + rnd.randrange(0, 64), BUF + rnd.randrange(0, 64), rnd.randrange(0, 64)
+        dst = BUF + 128 + rnd.randrange(0, 60)  # (not overlapping the source, except for memmove)
+        args = { 'memcpy': (dst, b, n), 'memmove': (a, b, n), 'memset': (a, rnd.getrandbits(9), n),
+                 'memcmp': (a, b, n), 'strlen': (a,), 'strcmp': (a, b), 'strcpy': (dst, b),
+                 'strchr': (a, rnd.choice((0, 0x61, 0x62, 0x80, 0xFF, 0x180))) }[name]
+        args += (0,) * (4 - len(args))
+
+        ram.memory[BUF:BUF + BUF_SIZE] = data
+        result = getattr(host, name)(*args)
+        host_data = bytes(ram.memory[BUF:BUF + BUF_SIZE])
+        ram.memory[BUF:BUF + BUF_SIZE] = data
+        expected = emulate(functions[name], args)
+        if result is None:
+            fallbacks += 1
+            continue
+        compared += 1
+        result &= 0xFFFFFFFF
+        same = sign(result) == sign(expected) if name in ('memcmp', 'strcmp') else result == expected
+        same_data = host_data == bytes(ram.memory[BUF:BUF + BUF_SIZE])
+        if not (same and same_data):
+            mismatches += 1
+            print(f"{name}({', '.join(hex(arg) for arg in args)}): host {result:#x}, emulated {expected:#x}" +
+                  ("" if same_data else ", memory differs"))
+    print(f"{name}: {compared} calls compared, {fallbacks} fallbacks")
+
+print("Mismatches:", mismatches)
+sys.exit(1 if mismatches else 0)